@@ -2,24 +2,57 @@
 #include "SocketManager.h"
 #include <string>
 #include <vector>
+#include <map>
 using namespace std;
 
+struct IssueOptions
+{
+    bool Compress = false;
+    bool PassOutput = false; // Let the job write straight to our stdout, unix sockets only
+    bool LeastLoaded = false; // Route by asking every server for its load instead of hashing
+    bool Short = false; // A quick job the server may batch with others
+    string AfterMode; // --after, --afterok or --afterany, empty when the job has no parents
+    string AfterJobs; // Comma separated parent job IDs
+    string Timeout; // Seconds the job may run, empty for no limit
+    string Deadline; // Seconds from submission by which the job has to be done, empty for best effort
+    vector<string> Inputs; // Local files uploaded with the job, found under $JOB_INPUT_DIR
+    string StdinInput; // Local file uploaded with the job and used as its stdin
+};
+
+struct ServerEndpoint
+{
+    string Name; // Shard prefix of the job IDs this server hands out, empty if unknown
+    string Host;
+    string Port;
+};
+
 class Commander {
 private:    
     SocketManager SocketController;
-    string ServerName;
-    string Port;
+    vector<ServerEndpoint> Servers;
+    map<uint64_t, size_t> HashRing;
 
     string ReceiveResponse();
     void SendCommand(const string& command);
+    bool Connect(size_t server);
+    vector<size_t> RouteByHash(const string& key) const;
+    vector<size_t> RouteByLoad();
+    vector<size_t> RouteByShard(const string& jobId) const;
+    void Broadcast(const string& command);
+    static uint64_t Hash(const string& key);
+    static string BaseName(const string& path);
 
 public:
-    Commander(const string& serverName, const string& port);
+    Commander(const string& serverList, const string& defaultPort);
     ~Commander();
 
-    void IssueJob(const string& job);
+    void IssueJob(const string& job, const IssueOptions& options);
     void SetConcurrency(int level);
     void StopJob(const string& jobId);
-    void PollJobs();
+    void PollJobs(const string& filter);
+    void ShowStats();
+    void WatchJobs();
+    void Trace(const string& mode);
+    void Restart();
     void ExitServer();
 };
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+using namespace std;
+
+// Usable CPUs of the server (affinity mask, cgroup v2 quota, NUMA nodes) and which of them jobs hold.
+// Not thread safe, the server only touches it under QueueMutex.
+class CpuTopology
+{
+private:
+    vector<int> Cpus;
+    map<int, int> CpuNodes;
+    map<int, bool> CpuBusy;
+    double QuotaCpus; // cpu.max limit in CPUs, 0 when unlimited
+
+    void DiscoverNodes();
+    void DiscoverQuota();
+    static vector<int> ParseCpuList(const string& list);
+
+public:
+    CpuTopology();
+
+    void Discover();
+    int GetDefaultConcurrency() const;
+    vector<int> Acquire(int count);
+    void Reserve(const vector<int>& cpus);
+    void Release(const vector<int>& cpus);
+    string Describe() const;
+    string DescribePlacement(const vector<int>& cpus) const;
+};
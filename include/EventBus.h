@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <list>
+#include <vector>
+#include <pthread.h>
+using namespace std;
+
+struct Subscriber
+{
+    deque<string> Events;
+    bool Overflowed;
+    int SocketFD; // Shut down if the watcher is still stuck sending when the server stops
+    pthread_cond_t EventsAvailable;
+};
+
+class EventBus
+{
+private:
+    size_t SubscriberCapacity;
+    bool IsClosed;
+    pthread_mutex_t BusMutex;
+    pthread_cond_t SubscribersGone;
+    list<Subscriber*> Subscribers;
+
+public:
+    EventBus(size_t subscriberCapacity);
+    ~EventBus();
+
+    Subscriber* Subscribe(int socketFD);
+    void Unsubscribe(Subscriber* subscriber);
+    void Publish(const string& event);
+    bool WaitForEvents(Subscriber* subscriber, vector<string>& events, bool& resync, int timeoutMs);
+    void Resync(Subscriber* subscriber);
+    void Close();
+    void WaitForSubscribers(int graceMs);
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <sys/uio.h>
+using namespace std;
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// Minimal io_uring on raw syscalls, one ring per thread. Used by SocketManager to submit a batch
+// of reads and sends with a single io_uring_enter. Off by default, and only threads that called
+// AllowForThisThread get a ring, so short-lived client threads do not pay for setting one up. When
+// the kernel (or a seccomp policy) refuses io_uring or the opcodes we need, ForThread returns null
+// and callers keep using plain blocking calls.
+class IoUring
+{
+private:
+    int RingFD;
+    unsigned* SqHead;
+    unsigned* SqTail;
+    unsigned* SqMask;
+    unsigned* SqArray;
+    unsigned* CqHead;
+    unsigned* CqTail;
+    unsigned* CqMask;
+    io_uring_sqe* Sqes;
+    io_uring_cqe* Cqes;
+    void* SqRing;
+    void* CqRing;
+    size_t SqRingSize;
+    size_t CqRingSize;
+    size_t SqesSize;
+    unsigned Entries;
+    unsigned Queued; // Prepared since the last submit
+    bool Broken; // io_uring_enter failed, entries may be left behind so the ring is not reused
+
+    static atomic<bool> Enabled;
+    static atomic<bool> Unsupported;
+
+    bool Setup(unsigned entries);
+    bool SupportsOpcodes(const vector<int>& opcodes);
+    io_uring_sqe* NextSqe();
+
+public:
+    vector<char> Buffers; // Scratch space for batched file reads, owned by the thread's ring
+
+    IoUring();
+    ~IoUring();
+
+    unsigned Capacity() const { return Entries; }
+    bool PrepareRead(int fd, char* buffer, unsigned length, uint64_t offset, uint64_t userData, bool linkNext);
+    bool PrepareSend(int socketFD, const char* data, unsigned length, uint64_t userData, bool linkNext);
+    int SubmitAndWait(unsigned waitCount);
+    bool PopCompletion(uint64_t& userData, int& result);
+
+    static IoUring* ForThread();
+    static void AllowForThisThread();
+    static void SetEnabled(bool enabled);
+    static bool IsEnabled() { return Enabled.load(memory_order_relaxed); }
+};
@@ -1,37 +1,172 @@
 #pragma once
 #include "SocketManager.h"
+#include "EventBus.h"
+#include "Zygote.h"
+#include "CpuTopology.h"
+#include "TimerWheel.h"
+#include <map>
 #include <vector>
-#include <queue>
+#include <deque>
+#include <set>
+#include <atomic>
 #include <pthread.h>
 using namespace std;
 
+struct Job
+{
+    string ID;
+    string Command;
+    int ClientSocket = -1;
+    bool Compress = false;
+    int OutputFD = -1; // Client's own stdout passed over a unix socket, -1 when output is spooled
+    bool Forwarded = false; // Already overflowed from a peer, never forwarded again
+    vector<string> After; // Parents that have to finish before the job may run
+    bool AfterAny = false; // Run after the parents whatever their exit status, otherwise only if they all succeeded
+    uint64_t SubmitTime = 0; // Tracer clock, only set while tracing
+    uint64_t TimeoutMs = 0; // Longest the job may run, 0 for no limit
+    uint64_t Deadline = 0; // TimerWheel::NowMs() by which the job has to be done, 0 for best effort
+    string InputDir; // Scratch directory holding the files uploaded with the job, removed when it ends
+    string StdinFile; // Uploaded file the job reads as stdin
+    bool Short = false; // Submitted with --short, may share a shell with other short jobs
+};
+
+struct BlockedJob
+{
+    Job Entry;
+    set<string> Waiting;
+};
+
+struct RunningJob
+{
+    string Command;
+    vector<int> Cpus;
+};
+
+struct KillTimer
+{
+    uint64_t TimerID;
+    string JobID;
+    bool Signalled; // SIGTERM already sent, the pending timer is the SIGKILL
+};
+
+struct ServerOptions
+{
+    string UnixPath;
+    int Acceptors = 1;
+    int Backlog = SOMAXCONN;
+    string ShardName; // Prefixed to job IDs so clients can route stop requests
+    vector<string> Peers; // host:port of servers that take our overflow
+    int BatchSize = 1; // Short jobs run up to this many per shell process
+    int BatchWindowMs = 2; // How long a batch waits for more jobs to arrive
+    int PinCpus = 0; // CPUs reserved for each running job, 0 leaves jobs unpinned
+    bool Trace = false; // Start with tracing enabled
+    bool IoUring = false; // Batch socket sends through io_uring where the kernel allows it
+    int KillGraceMs = 2000; // Between SIGTERM and SIGKILL of an overrunning job
+    vector<string> Arguments; // Command line, executed again on a hot restart
+    int TakeoverFD = -1; // Channel from the server we replace on a hot restart
+};
+
 class Server
 {
 private:
     int Port;
+    ServerOptions Options;
     int BufferSize;
     int ThreadPoolSize;
     int ConcurrencyLevel;
-    bool IsRunning;
-    int JobCounter;
+    atomic<bool> IsRunning; // Also read by acceptors and client threads without QueueMutex
+    atomic<int> JobCounter; // Client threads take IDs concurrently
     int ActiveWorkers;
     vector<pthread_t> WorkerThreads;
     pthread_mutex_t QueueMutex;
     pthread_cond_t JobAvailable;
     pthread_cond_t SpaceAvailable;
-    queue<tuple<string, string, int>> JobQueue;
+    deque<Job> JobQueue;
+    map<string, BlockedJob> BlockedJobs;
+    map<string, vector<string>> Dependents;
+    map<string, int> FinishedJobs; // Exit status of recent jobs, -1 if they never ran
+    deque<string> FinishedOrder;
     SocketManager SocketController;
+    pthread_mutex_t StatsMutex;
+    uint64_t CompressedTransfers;
+    uint64_t OutputBytesRaw;
+    uint64_t OutputBytesSent;
+    EventBus Events;
+    Zygote Launcher;
+    CpuTopology Topology;
+    map<string, RunningJob> RunningJobs;
+    TimerWheel Timers;
+    pthread_mutex_t KillMutex;
+    map<pid_t, KillTimer> KillTimers; // Process group leaders of running jobs with a time limit
+    pthread_mutex_t NoticeMutex;
+    pthread_cond_t NoticeAvailable;
+    deque<pair<Job, string>> FailureNotices; // Jobs failed under QueueMutex, their clients are told by NoticeThread
+    bool NoticesClosed;
+    pthread_t NoticeThread;
+    atomic<bool> HandedOff; // Listeners and waiting jobs moved to a newer server by a hot restart, only draining now
+    bool RestartPending;
+    int HandoffFD; // Channel to the server that took over from us, the one from our predecessor is Options.TakeoverFD
+    pthread_mutex_t HandoffMutex;
+    pthread_t HandoffThread;
+    set<string> InheritedJobs; // Still running in the server we took over from
 
     static void* WorkerThreadFunction(void* arg);
     static void* HandleClient(void* arg);
-    void ProcessJob(int clientSocket, const string& job, const string& jobID);
+    static void* AcceptorThreadFunction(void* arg);
+    int ProcessJob(const Job& job, const vector<int>& cpus);
+    vector<int> ProcessBatch(const vector<Job>& batch, const vector<int>& cpus);
+    void SendJobOutput(const Job& job, const string& outputFile, bool timedOut);
+    bool IsBatchable(const Job& job);
+    void CollectBatch(vector<Job>& batch);
+    static string ShellQuote(const string& text);
+    pid_t LaunchJob(const string& command, int outputFD, int inputFD, const vector<int>& cpus, bool& fromZygote);
+    bool WaitJob(pid_t pid, bool fromZygote, int& status);
+    bool ParseJobOptions(const string& spec, Job& job);
+    bool ReceiveInput(Job& job, const string& name, bool isStdin);
+    static void DiscardInputs(const Job& job);
+    string GetStats();
+    void WatchJobs(int clientSocket);
+    string BuildSnapshot();
+    string BuildRunningList();
+    string BuildBlockedList();
+    bool IsKnownJob(const string& jobID);
+    bool BlockOnParents(Job& job, string& error);
+    void CompleteJob(const string& jobID, int status);
+    static int ExitCode(int status);
+    string NextJobID();
+    string GetLoad();
+    bool ForwardJob(const Job& job, const string& spec);
+    void AdmitJob(Job& job, const string& spec);
+    void ScheduleExpiry(const Job& job);
+    string HotRestart();
+    bool WaitForHandoff(int channel, string& message);
+    string SerializeState(vector<int>& fds);
+    bool AdoptState();
+    static void WriteJob(ostream& out, const Job& job, vector<int>& fds);
+    bool ReadJob(istream& in, int channel, Job& job);
+    bool SendHandoff(const string& message, const vector<int>& fds);
+    void HandOffJob(const Job& job, const string& spec);
+    void HandOffClient(int clientSocket);
+    void FinishInherited(const string& jobID, int status);
+    void FinishDrain();
+    static void* HandoffThreadFunction(void* arg);
+    static void* AdmitThreadFunction(void* arg);
+    void EnqueueJob(const Job& job);
+    void ExpireJob(const string& jobID);
+    void MissDeadline(const Job& job);
+    void NotifyFailure(const Job& job, const string& response);
+    static void* NoticeThreadFunction(void* arg);
+    void ArmKillTimer(pid_t pid, const Job& job);
+    bool DisarmKillTimer(pid_t pid);
+    void OnKillTimer(pid_t pid);
+    string HandleTrace(const string& argument);
     void HandleRemainingJobs();
     void SetConcurrency(int newLevel);
     void StopServer();
     void RemoveJob(const string& jobID, int clientSocket);
 
 public:
-    Server(int port, int bufferSize, int threadPoolSize);
+    Server(int port, int bufferSize, int threadPoolSize, const ServerOptions& options);
     ~Server();
     
     void Start();
@@ -43,4 +178,17 @@ struct ClientHandlerArgs
     int ClientSocket;
 };
 
+struct AdmitArgs
+{
+    Server* ServerInstance;
+    Job Entry;
+    string Spec; // As the client sent it, for forwarding to a peer
+};
+
+struct AcceptorArgs
+{
+    Server* ServerInstance;
+    size_t Listener;
+};
+
 
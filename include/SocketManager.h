@@ -1,5 +1,8 @@
 #pragma once
+#include "Transport.h"
+#include "IoUring.h"
 #include <string>
+#include <vector>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
@@ -10,25 +13,52 @@ using namespace std;
 class SocketManager
 {
 private:
-    int ServerFD;
+    vector<int> ServerFDs;
+    vector<unique_ptr<Transport>> Listeners;
     int ClientFD;
-    struct addrinfo* AddrInfo;
-    
-    void FreeResources();
+    unique_ptr<Transport> ClientTransport;
+
+    bool AddListener(unique_ptr<Transport> transport, int backlog);
     uint64_t Htonll(uint64_t value);
     uint64_t Ntohll(uint64_t value);
+    bool SendAll(int socketFD, const char* data, size_t length);
+    bool ReceiveAll(int socketFD, char* data, size_t length);
+    bool SendFileRange(int socketFD, int fileFD, uint64_t offset, uint64_t end);
+    bool SendFileDataUring(IoUring* ring, int socketFD, int fileFD, uint64_t fileSize);
+    bool WaitForCompletions(IoUring* ring, unsigned count, vector<int>& results);
+
+#ifdef COUNT_SEND_SYSCALLS
+    static atomic<uint64_t> SendSyscalls; // Only in benchmark builds, the server does not pay for it
+#endif
 
 public:
     SocketManager();
     ~SocketManager();
 
     bool ResolveAndConnect(const string& hostname, const string& port);
-    bool SetupServer(const string& port);
-    int AcceptConnection();
+    bool SetupServer(const string& port, int listenerCount, int backlog);
+    bool SetupUnixServer(const string& path, int backlog);
+    size_t GetListenerCount() const;
+    int GetListenerFD(size_t listener) const;
+    void AdoptListener(int serverFD, unique_ptr<Transport> transport);
+    void ReleaseListeners();
+    int AcceptConnection(size_t listener);
     bool SendMessage(int socketFD, const string& message);
     bool ReceiveMessage(int socketFD, string& message);
     bool ReceiveFileData(int socketFD);
+    bool ReceiveFileData(int socketFD, int outputFD);
     bool SendFileData(int socketFD, const string& fileName);
+    bool SendCompressedFileData(int socketFD, const string& fileName, uint64_t& rawBytes, uint64_t& sentBytes);
+    bool ReceiveCompressedFileData(int socketFD);
+    bool SendFD(int socketFD, int fd);
+    bool ReceiveFD(int socketFD, int& fd);
+    static bool IsUnixSocket(int socketFD);
+    bool RelayStream(int sourceFD, int destinationFD);
     int GetClientSocketFD() const;
+    void CloseClientSocket();
+    bool SupportsFdPassing() const;
+#ifdef COUNT_SEND_SYSCALLS
+    static uint64_t GetSendSyscalls() { return SendSyscalls.load(memory_order_relaxed); }
+#endif
     void CloseServerSocket();
 };
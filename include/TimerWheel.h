@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <vector>
+#include <pthread.h>
+using namespace std;
+
+struct Timer
+{
+    uint64_t ID;
+    uint64_t ExpiryTick;
+    function<void()> Callback;
+};
+
+// Hashed timer wheel served by a single thread. Callbacks run on that thread without the wheel
+// lock held, so they may schedule or cancel other timers.
+class TimerWheel
+{
+private:
+    uint64_t TickMs;
+    vector<list<Timer>> Slots;
+    map<uint64_t, size_t> TimerSlots; // Pending timer ID to its slot, for Cancel
+    uint64_t NextTimerID;
+    uint64_t CurrentTick;
+    uint64_t StartMs;
+    bool IsRunning;
+    bool HasThread;
+    pthread_t WheelThread;
+    pthread_mutex_t WheelMutex;
+    pthread_cond_t WheelChanged;
+
+    static void* WheelThreadFunction(void* arg);
+
+public:
+    TimerWheel(uint64_t tickMs, size_t slotCount);
+    ~TimerWheel();
+
+    bool Start();
+    void Stop();
+    uint64_t Schedule(uint64_t delayMs, function<void()> callback);
+    void Cancel(uint64_t timerID);
+    static uint64_t NowMs();
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <atomic>
+#include <cstdint>
+using namespace std;
+
+struct TraceEvent
+{
+    const char* Name;
+    uint64_t Start; // Nanoseconds on the monotonic clock
+    uint64_t Duration;
+    int ThreadID;
+};
+
+// Process wide tracing into per-thread ring buffers, dumped as Chrome trace JSON (opens in Perfetto).
+// Writers never lock: each ring has a single writer, and each slot carries a sequence number so a dump
+// skips slots that are overwritten while it copies them.
+class Tracer
+{
+private:
+    static atomic<bool> Enabled;
+
+public:
+    static bool IsEnabled() { return Enabled.load(memory_order_relaxed); }
+    static void SetEnabled(bool enabled);
+    static uint64_t Now();
+    static void Record(const char* name, uint64_t start, uint64_t end);
+    static string DumpChromeJson();
+};
+
+// Times the enclosing scope, costs one relaxed load when tracing is off
+class TraceScope
+{
+private:
+    const char* Name;
+    uint64_t Start;
+
+public:
+    TraceScope(const char* name) : Name(Tracer::IsEnabled() ? name : nullptr), Start(Name ? Tracer::Now() : 0) {}
+    ~TraceScope()
+    {
+        if (Name)
+        {
+            Tracer::Record(Name, Start, Tracer::Now());
+        }
+    }
+};
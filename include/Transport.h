@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <memory>
+using namespace std;
+
+// A way of reaching the server, either as a client (Connect) or as the server itself (Listen)
+class Transport
+{
+public:
+    virtual ~Transport() {}
+
+    virtual int Connect() = 0;
+    virtual int Listen(int backlog) = 0;
+    virtual void Cleanup() {}
+    virtual void Adopt() {} // Takes over a listener set up by another process, so Cleanup still applies
+    virtual bool SupportsFdPassing() const { return false; }
+    virtual string Describe() const = 0;
+
+    static unique_ptr<Transport> Create(const string& serverName, const string& port);
+    static bool SplitHostPort(const string& address, const string& defaultPort, string& host, string& port);
+};
+
+class TcpTransport : public Transport
+{
+private:
+    string Host;
+    string Port;
+    bool ReusePort;
+
+public:
+    TcpTransport(const string& host, const string& port, bool reusePort = false);
+
+    int Connect() override;
+    int Listen(int backlog) override;
+    string Describe() const override;
+};
+
+class UnixTransport : public Transport
+{
+private:
+    string Path;
+    bool IsBound;
+
+    bool FillAddress(struct sockaddr_un& address) const;
+    bool RemoveStaleSocket();
+
+public:
+    UnixTransport(const string& path);
+
+    int Connect() override;
+    int Listen(int backlog) override;
+    void Cleanup() override;
+    void Adopt() override;
+    bool SupportsFdPassing() const override { return true; }
+    string Describe() const override;
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+using namespace std;
+
+// Small single-threaded helper forked before the server starts any threads. Jobs are spawned
+// from it, so fork cost does not grow with the server and no server descriptors leak into jobs.
+class Zygote
+{
+private:
+    pid_t HelperPID;
+    int ControlFD;
+    int NextRequestID;
+    bool IsAlive;
+    pthread_t ReaderThread;
+    pthread_mutex_t ZygoteMutex;
+    pthread_cond_t StateChanged;
+    map<int, pid_t> SpawnResults;   // Request ID to job pid, or -errno when the spawn failed
+    map<pid_t, int> ExitStatuses;
+    set<pid_t> Children; // Spawned and not waited for yet, exits of any other pid are dropped
+
+    static void HelperLoop(int controlFD);
+    static void* ReaderThreadFunction(void* arg);
+
+public:
+    Zygote();
+    ~Zygote();
+
+    bool Start();
+    bool IsRunning();
+    pid_t Spawn(const string& command, int outputFD, int inputFD, const vector<int>& cpus, bool& mayHaveStarted);
+    bool Wait(pid_t pid, int& status);
+    static void ApplyAffinity(const vector<int>& cpus);
+    static void RunChild(const string& command, int outputFD, int inputFD, const vector<int>& cpus);
+};
@@ -1,13 +1,42 @@
 #include "Commander.h"
 #include <iostream>
+#include <sstream>
+#include <algorithm>
 
-Commander::Commander(const string& serverName, const string& port)
-    : ServerName(serverName), Port(port)
+static const int VirtualNodesPerServer = 100;
+
+// serverList is a comma separated list of [name=]host[:port] or [name=]unix:<path> entries
+Commander::Commander(const string& serverList, const string& defaultPort)
 {
-    if (!SocketController.ResolveAndConnect(ServerName, Port))
+    size_t start = 0;
+    while (start <= serverList.length())
     {
-        cerr << "Failed to connect to server " << ServerName << " on port " << Port << endl;
-        exit(EXIT_FAILURE);
+        size_t end = serverList.find(',', start);
+        string entry = serverList.substr(start, end == string::npos ? string::npos : end - start);
+        start = (end == string::npos) ? serverList.length() + 1 : end + 1;
+
+        ServerEndpoint endpoint;
+        size_t equals = entry.find('=');
+        if (equals != string::npos)
+        {
+            endpoint.Name = entry.substr(0, equals);
+            entry = entry.substr(equals + 1);
+        }
+        if (!Transport::SplitHostPort(entry, defaultPort, endpoint.Host, endpoint.Port))
+        {
+            cerr << "Invalid server " << entry << ", expected host:port or a default port" << endl;
+            exit(EXIT_FAILURE);
+        }
+        Servers.push_back(endpoint);
+    }
+
+    // Consistent hashing keeps most jobs on the same server when the list changes
+    for (size_t i = 0; i < Servers.size(); i++)
+    {
+        for (int node = 0; node < VirtualNodesPerServer; node++)
+        {
+            HashRing[Hash(Servers[i].Host + ":" + Servers[i].Port + "#" + to_string(node))] = i;
+        }
     }
 }
 
@@ -15,45 +44,308 @@ Commander::~Commander()
 {
 }
 
-void Commander::IssueJob(const string& job)
+void Commander::IssueJob(const string& job, const IssueOptions& options)
 {
-    auto command = "issueJob " + job;
+    // Dependencies only resolve on the parent's own server
+    vector<size_t> candidates = options.AfterJobs.empty() ? vector<size_t>() : RouteByShard(options.AfterJobs);
+    if (candidates.empty())
+    {
+        candidates = options.LeastLoaded ? RouteByLoad() : RouteByHash(job);
+    }
+    bool connected = false;
+    for (size_t i = 0; i < candidates.size() && !connected; i++) // Fail over to the next choice
+    {
+        connected = Connect(candidates[i]);
+    }
+    if (!connected)
+    {
+        cerr << "No server available for the job" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.PassOutput && !SocketController.SupportsFdPassing())
+    {
+        cerr << "--passfd requires a unix socket connection" << endl;
+        return;
+    }
+
+    string command = "issueJob ";
+    if (options.Compress)
+    {
+        command += "--compress ";
+    }
+    if (options.PassOutput)
+    {
+        command += "--passfd ";
+    }
+    if (options.Short)
+    {
+        command += "--short ";
+    }
+    if (!options.AfterMode.empty())
+    {
+        command += options.AfterMode + " " + options.AfterJobs + " ";
+    }
+    if (!options.Timeout.empty())
+    {
+        command += "--timeout " + options.Timeout + " ";
+    }
+    if (!options.Deadline.empty())
+    {
+        command += "--deadline " + options.Deadline + " ";
+    }
+    // The files are streamed in the same order as their options
+    vector<string> uploads = options.Inputs;
+    for (const auto& input : options.Inputs)
+    {
+        command += "--input " + BaseName(input) + " ";
+    }
+    if (!options.StdinInput.empty())
+    {
+        command += "--stdin " + BaseName(options.StdinInput) + " ";
+        uploads.push_back(options.StdinInput);
+    }
+    command += job;
     SendCommand(command);
+    if (options.PassOutput)
+    {
+        cout << flush;
+        SocketController.SendFD(SocketController.GetClientSocketFD(), STDOUT_FILENO);
+    }
+    for (const auto& upload : uploads)
+    {
+        if (!SocketController.SendFileData(SocketController.GetClientSocketFD(), upload))
+        {
+            cerr << "Failed to upload " << upload << endl;
+            return;
+        }
+    }
 
-    ReceiveResponse();
+    if (ReceiveResponse().find("SUBMITTED") == string::npos) // Rejected, e.g. an unknown dependency
+    {
+        return;
+    }
     string response = ReceiveResponse();
     if (response.find("output start") != string::npos)
     {
         int clientFD = SocketController.GetClientSocketFD();
-        SocketController.ReceiveFileData(clientFD);
+        if (options.PassOutput)
+        {
+            // The output already went to our stdout
+        }
+        else if (options.Compress)
+        {
+            SocketController.ReceiveCompressedFileData(clientFD);
+        }
+        else
+        {
+            SocketController.ReceiveFileData(clientFD);
+        }
         ReceiveResponse();
     }
 }
 
 void Commander::SetConcurrency(int level)
 {
-    auto command = "setConcurrency " + to_string(level);
-    SendCommand(command);
-    ReceiveResponse();
+    Broadcast("setConcurrency " + to_string(level));
 }
 
+// Jobs carry the shard name of their server, unknown shards are asked everywhere
 void Commander::StopJob(const string& jobId)
 {
-    auto command = "stop " + jobId;
-    SendCommand(command);
-    ReceiveResponse();
+    string command = "stop " + jobId;
+    vector<size_t> owner = RouteByShard(jobId);
+    if (!owner.empty())
+    {
+        if (Connect(owner.front()))
+        {
+            SendCommand(command);
+            ReceiveResponse();
+        }
+        return;
+    }
+
+    string reply;
+    for (size_t i = 0; i < Servers.size(); i++)
+    {
+        string response;
+        if (!Connect(i))
+        {
+            continue;
+        }
+        SendCommand(command);
+        if (SocketController.ReceiveMessage(SocketController.GetClientSocketFD(), response) &&
+            (reply.empty() || response.find("REMOVED") != string::npos))
+        {
+            reply = response;
+        }
+    }
+    cout << reply; // Server replies end with their own newline
+}
+
+void Commander::PollJobs(const string& filter)
+{
+    Broadcast(filter.empty() ? "poll" : "poll " + filter);
+}
+
+void Commander::ShowStats()
+{
+    Broadcast("stats");
+}
+
+// Watching is limited to the first server in the list
+void Commander::WatchJobs()
+{
+    if (!Connect(0))
+    {
+        exit(EXIT_FAILURE);
+    }
+    SendCommand("watch");
+    int clientFD = SocketController.GetClientSocketFD();
+    string events;
+    while (SocketController.ReceiveMessage(clientFD, events)) // Runs until the server goes away
+    {
+        cout << events << flush;
+    }
 }
 
-void Commander::PollJobs()
+// Tracing is per server, so like watch this only talks to the first one
+void Commander::Trace(const string& mode)
 {
-    SendCommand("poll");
+    if (!Connect(0))
+    {
+        exit(EXIT_FAILURE);
+    }
+    SendCommand(mode.empty() ? "trace" : "trace " + mode);
     ReceiveResponse();
 }
 
+void Commander::Restart()
+{
+    Broadcast("restart");
+}
+
 void Commander::ExitServer()
 {
-    SendCommand("exit");
-    ReceiveResponse();
+    Broadcast("exit");
+}
+
+void Commander::Broadcast(const string& command)
+{
+    for (size_t i = 0; i < Servers.size(); i++)
+    {
+        if (Connect(i))
+        {
+            SendCommand(command);
+            ReceiveResponse();
+        }
+    }
+}
+
+bool Commander::Connect(size_t server)
+{
+    const ServerEndpoint& endpoint = Servers[server];
+    if (!SocketController.ResolveAndConnect(endpoint.Host, endpoint.Port))
+    {
+        cerr << "Failed to connect to server " << endpoint.Host << " on port " << endpoint.Port << endl;
+        return false;
+    }
+    return true;
+}
+
+// The server named by the shard prefix of a job ID, nothing if no entry has that name
+vector<size_t> Commander::RouteByShard(const string& jobId) const
+{
+    size_t dot = jobId.find('.');
+    string shard = (dot == string::npos) ? "" : jobId.substr(0, dot);
+    for (size_t i = 0; i < Servers.size() && !shard.empty(); i++)
+    {
+        if (Servers[i].Name == shard)
+        {
+            return { i };
+        }
+    }
+    return {};
+}
+
+// Servers in ring order starting from the key's position, so failover is consistent too
+vector<size_t> Commander::RouteByHash(const string& key) const
+{
+    vector<size_t> order;
+    auto node = HashRing.lower_bound(Hash(key));
+    for (size_t visited = 0; visited < HashRing.size() && order.size() < Servers.size(); visited++, node++)
+    {
+        if (node == HashRing.end())
+        {
+            node = HashRing.begin();
+        }
+        if (find(order.begin(), order.end(), node->second) == order.end())
+        {
+            order.push_back(node->second);
+        }
+    }
+    return order;
+}
+
+// Servers ordered by busy jobs per slot, unreachable servers are left out
+vector<size_t> Commander::RouteByLoad()
+{
+    vector<pair<double, size_t>> loads;
+    for (size_t i = 0; i < Servers.size(); i++)
+    {
+        string response;
+        if (!Connect(i))
+        {
+            continue;
+        }
+        SendCommand("load");
+        if (!SocketController.ReceiveMessage(SocketController.GetClientSocketFD(), response))
+        {
+            continue;
+        }
+
+        istringstream load(response);
+        string tag;
+        int queued = 0;
+        int running = 0;
+        int concurrency = 1;
+        load >> tag >> queued >> running >> concurrency;
+        loads.emplace_back(static_cast<double>(queued + running) / max(concurrency, 1), i);
+    }
+
+    stable_sort(loads.begin(), loads.end(), [](const pair<double, size_t>& a, const pair<double, size_t>& b) { return a.first < b.first; });
+    vector<size_t> order;
+    for (const auto& load : loads)
+    {
+        order.push_back(load.second);
+    }
+    return order;
+}
+
+// FNV-1a
+uint64_t Commander::Hash(const string& key)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    // FNV-1a alone leaves keys that differ in their last characters close together on the ring,
+    // so mix the high bits as well (the murmur3 finalizer)
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb93fe53d85f3ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// The file name an upload is stored under on the server, without the local directories
+string Commander::BaseName(const string& path)
+{
+    size_t slash = path.find_last_of('/');
+    return (slash == string::npos) ? path : path.substr(slash + 1);
 }
 
 void Commander::SendCommand(const string& command)
@@ -0,0 +1,237 @@
+#include "CpuTopology.h"
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+#include <sched.h>
+#include <dirent.h>
+
+CpuTopology::CpuTopology() : QuotaCpus(0)
+{
+}
+
+void CpuTopology::Discover()
+{
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &mask))
+            {
+                Cpus.push_back(cpu);
+                CpuBusy[cpu] = false;
+            }
+        }
+    }
+    if (Cpus.empty()) // Should not happen, but never leave the server without a CPU
+    {
+        Cpus.push_back(0);
+        CpuBusy[0] = false;
+    }
+
+    DiscoverNodes();
+    DiscoverQuota();
+}
+
+void CpuTopology::DiscoverNodes()
+{
+    for (int cpu : Cpus)
+    {
+        CpuNodes[cpu] = 0;
+    }
+
+    DIR* nodes = opendir("/sys/devices/system/node");
+    if (nodes == nullptr)
+    {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(nodes)) != nullptr)
+    {
+        string name = entry->d_name;
+        if (name.compare(0, 4, "node") != 0 || name.length() == 4 || !isdigit(name[4]))
+        {
+            continue;
+        }
+
+        ifstream cpuList("/sys/devices/system/node/" + name + "/cpulist");
+        string list;
+        getline(cpuList, list);
+        for (int cpu : ParseCpuList(list))
+        {
+            if (CpuNodes.count(cpu))
+            {
+                CpuNodes[cpu] = stoi(name.substr(4));
+            }
+        }
+    }
+    closedir(nodes);
+}
+
+// Takes the tightest cpu.max along the cgroup v2 path of the server
+void CpuTopology::DiscoverQuota()
+{
+    string mountPoint;
+    ifstream mounts("/proc/self/mounts");
+    string device;
+    string path;
+    string type;
+    string rest;
+    while (mounts >> device >> path >> type && getline(mounts, rest))
+    {
+        if (type == "cgroup2")
+        {
+            mountPoint = path;
+            break;
+        }
+    }
+
+    string group;
+    ifstream cgroups("/proc/self/cgroup");
+    string line;
+    while (getline(cgroups, line))
+    {
+        if (line.compare(0, 3, "0::") == 0)
+        {
+            group = line.substr(3);
+        }
+    }
+    if (mountPoint.empty() || group.empty())
+    {
+        return;
+    }
+
+    while (true)
+    {
+        ifstream cpuMax(mountPoint + group + "/cpu.max");
+        string quota;
+        long period = 0;
+        if (cpuMax >> quota >> period && quota != "max" && period > 0)
+        {
+            double cpus = stod(quota) / period;
+            if (QuotaCpus == 0 || cpus < QuotaCpus)
+            {
+                QuotaCpus = cpus;
+            }
+        }
+
+        if (group.empty() || group == "/")
+        {
+            break;
+        }
+        size_t slash = group.rfind('/');
+        group = (slash == 0 || slash == string::npos) ? "/" : group.substr(0, slash);
+    }
+}
+
+int CpuTopology::GetDefaultConcurrency() const
+{
+    int cpus = Cpus.size();
+    if (QuotaCpus > 0)
+    {
+        cpus = min(cpus, max(1, static_cast<int>(ceil(QuotaCpus))));
+    }
+    return cpus;
+}
+
+// Picks free CPUs from the NUMA node with the most of them, so concurrent jobs spread across nodes.
+// Returns nothing when no node has enough free CPUs, the job then runs unpinned.
+vector<int> CpuTopology::Acquire(int count)
+{
+    map<int, vector<int>> freeByNode;
+    for (int cpu : Cpus)
+    {
+        if (!CpuBusy[cpu])
+        {
+            freeByNode[CpuNodes[cpu]].push_back(cpu);
+        }
+    }
+
+    const vector<int>* best = nullptr;
+    for (const auto& node : freeByNode)
+    {
+        if ((int)node.second.size() >= count && (best == nullptr || node.second.size() > best->size()))
+        {
+            best = &node.second;
+        }
+    }
+    if (best == nullptr)
+    {
+        return {};
+    }
+
+    vector<int> cpus(best->begin(), best->begin() + count);
+    for (int cpu : cpus)
+    {
+        CpuBusy[cpu] = true;
+    }
+    return cpus;
+}
+
+// Marks CPUs held by jobs another process placed, e.g. before a hot restart
+void CpuTopology::Reserve(const vector<int>& cpus)
+{
+    for (int cpu : cpus)
+    {
+        CpuBusy[cpu] = true;
+    }
+}
+
+void CpuTopology::Release(const vector<int>& cpus)
+{
+    for (int cpu : cpus)
+    {
+        CpuBusy[cpu] = false;
+    }
+}
+
+string CpuTopology::Describe() const
+{
+    ostringstream description;
+    description << Cpus.size() << " cpus";
+    if (QuotaCpus > 0)
+    {
+        description << ", cgroup quota " << QuotaCpus << " cpus";
+    }
+    return description.str();
+}
+
+string CpuTopology::DescribePlacement(const vector<int>& cpus) const
+{
+    if (cpus.empty())
+    {
+        return "unpinned";
+    }
+    string placement = "cpus ";
+    for (size_t i = 0; i < cpus.size(); i++)
+    {
+        placement += (i > 0 ? "," : "") + to_string(cpus[i]);
+    }
+    return placement + " node " + to_string(CpuNodes.at(cpus.front()));
+}
+
+// Parses the kernel's "0-3,8,10-11" format
+vector<int> CpuTopology::ParseCpuList(const string& list)
+{
+    vector<int> cpus;
+    stringstream ranges(list);
+    string range;
+    while (getline(ranges, range, ','))
+    {
+        if (range.empty())
+        {
+            continue;
+        }
+        size_t dash = range.find('-');
+        int first = stoi(range.substr(0, dash));
+        int last = (dash == string::npos) ? first : stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
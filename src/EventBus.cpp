@@ -0,0 +1,154 @@
+#include "EventBus.h"
+#include <ctime>
+#include <cerrno>
+#include <sys/socket.h>
+
+EventBus::EventBus(size_t subscriberCapacity) : SubscriberCapacity(subscriberCapacity), IsClosed(false)
+{
+    pthread_mutex_init(&BusMutex, nullptr);
+    pthread_cond_init(&SubscribersGone, nullptr);
+}
+
+EventBus::~EventBus()
+{
+    pthread_mutex_destroy(&BusMutex);
+    pthread_cond_destroy(&SubscribersGone);
+}
+
+Subscriber* EventBus::Subscribe(int socketFD)
+{
+    Subscriber* subscriber = new Subscriber();
+    subscriber->Overflowed = false;
+    subscriber->SocketFD = socketFD;
+    pthread_cond_init(&subscriber->EventsAvailable, nullptr);
+
+    pthread_mutex_lock(&BusMutex);
+    Subscribers.push_back(subscriber);
+    pthread_mutex_unlock(&BusMutex);
+    return subscriber;
+}
+
+void EventBus::Unsubscribe(Subscriber* subscriber)
+{
+    pthread_mutex_lock(&BusMutex);
+    Subscribers.remove(subscriber);
+    if (Subscribers.empty())
+    {
+        pthread_cond_broadcast(&SubscribersGone);
+    }
+    pthread_mutex_unlock(&BusMutex);
+
+    pthread_cond_destroy(&subscriber->EventsAvailable);
+    delete subscriber;
+}
+
+// A subscriber that falls SubscriberCapacity events behind loses its backlog and is told to resync
+void EventBus::Publish(const string& event)
+{
+    pthread_mutex_lock(&BusMutex);
+    for (auto subscriber : Subscribers)
+    {
+        if (subscriber->Overflowed)
+        {
+            continue;
+        }
+        if (subscriber->Events.size() >= SubscriberCapacity)
+        {
+            subscriber->Events.clear();
+            subscriber->Overflowed = true;
+        }
+        else
+        {
+            subscriber->Events.push_back(event);
+        }
+        pthread_cond_signal(&subscriber->EventsAvailable);
+    }
+    pthread_mutex_unlock(&BusMutex);
+}
+
+// Returns false once the bus is closed and the subscriber has nothing left to deliver
+bool EventBus::WaitForEvents(Subscriber* subscriber, vector<string>& events, bool& resync, int timeoutMs)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&BusMutex);
+    while (subscriber->Events.empty() && !subscriber->Overflowed && !IsClosed)
+    {
+        if (pthread_cond_timedwait(&subscriber->EventsAvailable, &BusMutex, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+
+    events.assign(subscriber->Events.begin(), subscriber->Events.end());
+    subscriber->Events.clear();
+    resync = subscriber->Overflowed;
+    bool open = !IsClosed || !events.empty();
+    pthread_mutex_unlock(&BusMutex);
+    return open;
+}
+
+// Called by the subscriber right before it sends a fresh snapshot
+void EventBus::Resync(Subscriber* subscriber)
+{
+    pthread_mutex_lock(&BusMutex);
+    subscriber->Events.clear();
+    subscriber->Overflowed = false;
+    pthread_mutex_unlock(&BusMutex);
+}
+
+void EventBus::Close()
+{
+    pthread_mutex_lock(&BusMutex);
+    IsClosed = true;
+    for (auto subscriber : Subscribers)
+    {
+        pthread_cond_signal(&subscriber->EventsAvailable);
+    }
+    pthread_mutex_unlock(&BusMutex);
+}
+
+// Gives subscribers graceMs to deliver what they have, then shuts down the sockets of those still
+// there, so a watcher whose client stopped reading cannot hold up the server forever
+void EventBus::WaitForSubscribers(int graceMs)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += graceMs / 1000;
+    deadline.tv_nsec += (graceMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&BusMutex);
+    while (!Subscribers.empty())
+    {
+        if (pthread_cond_timedwait(&SubscribersGone, &BusMutex, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    // Unsubscribe runs before the socket is closed, so every fd left here is still the watcher's
+    for (auto subscriber : Subscribers)
+    {
+        if (subscriber->SocketFD >= 0)
+        {
+            shutdown(subscriber->SocketFD, SHUT_RDWR);
+        }
+    }
+    while (!Subscribers.empty())
+    {
+        pthread_cond_wait(&SubscribersGone, &BusMutex);
+    }
+    pthread_mutex_unlock(&BusMutex);
+}
@@ -0,0 +1,296 @@
+#include "IoUring.h"
+#include <iostream>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+static const unsigned RingEntries = 64;
+
+atomic<bool> IoUring::Enabled(false);
+atomic<bool> IoUring::Unsupported(false);
+
+static thread_local unique_ptr<IoUring> ThreadRing;
+static thread_local bool RingAllowed = false;
+
+IoUring::IoUring()
+    : RingFD(-1), SqHead(nullptr), SqTail(nullptr), SqMask(nullptr), SqArray(nullptr), CqHead(nullptr),
+      CqTail(nullptr), CqMask(nullptr), Sqes(nullptr), Cqes(nullptr), SqRing(MAP_FAILED), CqRing(MAP_FAILED),
+      SqRingSize(0), CqRingSize(0), SqesSize(0), Entries(0), Queued(0), Broken(false)
+{
+}
+
+IoUring::~IoUring()
+{
+    if (Sqes != nullptr)
+    {
+        munmap(Sqes, SqesSize);
+    }
+    if (CqRing != MAP_FAILED && CqRing != SqRing)
+    {
+        munmap(CqRing, CqRingSize);
+    }
+    if (SqRing != MAP_FAILED)
+    {
+        munmap(SqRing, SqRingSize);
+    }
+    if (RingFD != -1)
+    {
+        close(RingFD);
+    }
+}
+
+void IoUring::SetEnabled(bool enabled)
+{
+    Enabled.store(enabled, memory_order_relaxed);
+}
+
+// For long-lived threads that send enough to win back the ring setup
+void IoUring::AllowForThisThread()
+{
+    RingAllowed = true;
+}
+
+// The calling thread's ring, set up on first use. Null when io_uring is off, not supported or not
+// allowed on this thread.
+IoUring* IoUring::ForThread()
+{
+    if (!RingAllowed || !IsEnabled() || Unsupported.load(memory_order_relaxed))
+    {
+        return nullptr;
+    }
+    if (ThreadRing && ThreadRing->Broken)
+    {
+        ThreadRing.reset();
+    }
+    if (!ThreadRing)
+    {
+        unique_ptr<IoUring> ring(new IoUring());
+        if (!ring->Setup(RingEntries))
+        {
+            // Only a refusal is permanent, out of memory or descriptors just skips this attempt
+            int error = errno;
+            if ((error == ENOSYS || error == EINVAL || error == EPERM) && !Unsupported.exchange(true))
+            {
+                cerr << "io_uring is not available, using blocking socket I/O" << endl;
+            }
+            return nullptr;
+        }
+        ThreadRing = move(ring);
+    }
+    return ThreadRing.get();
+}
+
+#ifdef HAVE_IO_URING
+
+bool IoUring::Setup(unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    RingFD = syscall(__NR_io_uring_setup, entries, &params);
+    if (RingFD == -1)
+    {
+        return false;
+    }
+    // READ and SEND arrived in 5.6, older kernels have the ring but not what we submit
+    if (!SupportsOpcodes({ IORING_OP_READ, IORING_OP_SEND }))
+    {
+        return false;
+    }
+
+    SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap)
+    {
+        SqRingSize = CqRingSize = max(SqRingSize, CqRingSize);
+    }
+    SqRing = mmap(nullptr, SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFD, IORING_OFF_SQ_RING);
+    if (SqRing == MAP_FAILED)
+    {
+        return false;
+    }
+    CqRing = singleMap ? SqRing
+                       : mmap(nullptr, CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFD, IORING_OFF_CQ_RING);
+    if (CqRing == MAP_FAILED)
+    {
+        return false;
+    }
+    SqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(nullptr, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFD, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        return false;
+    }
+    Sqes = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(SqRing);
+    char* cq = static_cast<char*>(CqRing);
+    SqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    SqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    SqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    SqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    CqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    CqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    CqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    Cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    Entries = params.sq_entries;
+    return true;
+}
+
+bool IoUring::SupportsOpcodes(const vector<int>& opcodes)
+{
+    const unsigned probeOps = 256;
+    vector<char> buffer(sizeof(struct io_uring_probe) + probeOps * sizeof(struct io_uring_probe_op), 0);
+    struct io_uring_probe* probe = reinterpret_cast<struct io_uring_probe*>(buffer.data());
+    if (syscall(__NR_io_uring_register, RingFD, IORING_REGISTER_PROBE, probe, probeOps) == -1)
+    {
+        return false;
+    }
+    for (int opcode : opcodes)
+    {
+        if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED))
+        {
+            errno = EINVAL; // Counts as the kernel refusing io_uring
+            return false;
+        }
+    }
+    return true;
+}
+
+// Null when the submission queue is full
+io_uring_sqe* IoUring::NextSqe()
+{
+    unsigned head = __atomic_load_n(SqHead, __ATOMIC_ACQUIRE);
+    unsigned tail = *SqTail;
+    if (tail - head >= Entries)
+    {
+        return nullptr;
+    }
+    unsigned index = tail & *SqMask;
+    SqArray[index] = index;
+    io_uring_sqe* sqe = &Sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// The kernel only sees the entry once the tail moves past it
+static void Publish(unsigned* sqTail, unsigned& queued)
+{
+    __atomic_store_n(sqTail, *sqTail + 1, __ATOMIC_RELEASE);
+    queued++;
+}
+
+bool IoUring::PrepareRead(int fd, char* buffer, unsigned length, uint64_t offset, uint64_t userData, bool linkNext)
+{
+    io_uring_sqe* sqe = NextSqe();
+    if (sqe == nullptr)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer);
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->user_data = userData;
+    sqe->flags = linkNext ? IOSQE_IO_LINK : 0;
+    Publish(SqTail, Queued);
+    return true;
+}
+
+bool IoUring::PrepareSend(int socketFD, const char* data, unsigned length, uint64_t userData, bool linkNext)
+{
+    io_uring_sqe* sqe = NextSqe();
+    if (sqe == nullptr)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = socketFD;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = length;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = userData;
+    sqe->flags = linkNext ? IOSQE_IO_LINK : 0;
+    Publish(SqTail, Queued);
+    return true;
+}
+
+// Submits everything prepared and waits for waitCount completions, returns -errno on failure
+int IoUring::SubmitAndWait(unsigned waitCount)
+{
+    int result;
+    do
+    {
+        result = syscall(__NR_io_uring_enter, RingFD, Queued, waitCount, IORING_ENTER_GETEVENTS, nullptr, 0);
+    } while (result == -1 && errno == EINTR);
+    if (result == -1)
+    {
+        Broken = true;
+        return -errno;
+    }
+    Queued -= min(Queued, static_cast<unsigned>(result));
+    return result;
+}
+
+bool IoUring::PopCompletion(uint64_t& userData, int& result)
+{
+    unsigned head = *CqHead;
+    if (head == __atomic_load_n(CqTail, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+    io_uring_cqe* cqe = &Cqes[head & *CqMask];
+    userData = cqe->user_data;
+    result = cqe->res;
+    __atomic_store_n(CqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+#else // Built without the io_uring headers, ForThread always falls back
+
+bool IoUring::Setup(unsigned)
+{
+    errno = ENOSYS;
+    return false;
+}
+
+bool IoUring::SupportsOpcodes(const vector<int>&)
+{
+    return false;
+}
+
+io_uring_sqe* IoUring::NextSqe()
+{
+    return nullptr;
+}
+
+bool IoUring::PrepareRead(int, char*, unsigned, uint64_t, uint64_t, bool)
+{
+    return false;
+}
+
+bool IoUring::PrepareSend(int, const char*, unsigned, uint64_t, bool)
+{
+    return false;
+}
+
+int IoUring::SubmitAndWait(unsigned)
+{
+    return -ENOSYS;
+}
+
+bool IoUring::PopCompletion(uint64_t&, int&)
+{
+    return false;
+}
+
+#endif
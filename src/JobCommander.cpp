@@ -1,45 +1,136 @@
 #include "Commander.h"
 #include <iostream>
 #include <string>
+#include <unistd.h>
 using namespace std;
 
 int main(int argc, char* argv[])
 {
-    if (argc < 4)
+    if (argc < 3)
     {
         cerr << "Usage: " << argv[0] << " <serverName> <portNum> <jobCommanderInputCommand> [arguments]" << endl;
+        cerr << "       " << argv[0] << " <[name=]host[:port]|unix:path>,... [portNum] <jobCommanderInputCommand> [arguments]" << endl;
         return EXIT_FAILURE;
     }
 
-    string serverName = argv[1];
-    string port = argv[2];
-    Commander commander(serverName, port);
-    string command = argv[3];
+    string serverList = argv[1];
+    string secondArgument = argv[2];
+    // The port may be left out when every server in the list carries its own port or is a unix socket
+    bool hasPort = secondArgument.find_first_not_of("0123456789") == string::npos;
+    int commandIndex = hasPort ? 3 : 2;
+    if (argc <= commandIndex)
+    {
+        cerr << "Missing jobCommanderInputCommand." << endl;
+        return EXIT_FAILURE;
+    }
+    string port = hasPort ? secondArgument : "";
+    Commander commander(serverList, port);
+    string command = argv[commandIndex];
+    int argCount = argc - commandIndex - 1; // Arguments after the command
 
-    if (command == "issueJob" && argc >= 5)
+    if (command == "issueJob" && argCount >= 1)
     {
+        IssueOptions options;
+        int first = commandIndex + 1;
+        for (; first < argc && string(argv[first]).rfind("--", 0) == 0; first++)
+        {
+            string option = argv[first];
+            if (option == "--compress")
+            {
+                options.Compress = true;
+            }
+            else if (option == "--passfd")
+            {
+                options.PassOutput = true;
+            }
+            else if (option == "--least-loaded")
+            {
+                options.LeastLoaded = true;
+            }
+            else if (option == "--short")
+            {
+                options.Short = true;
+            }
+            else if ((option == "--after" || option == "--afterok" || option == "--afterany") && first + 1 < argc)
+            {
+                options.AfterMode = option;
+                options.AfterJobs = argv[++first];
+            }
+            else if (option == "--timeout" && first + 1 < argc)
+            {
+                options.Timeout = argv[++first];
+            }
+            else if (option == "--deadline" && first + 1 < argc)
+            {
+                options.Deadline = argv[++first];
+            }
+            else if ((option == "--input" || option == "--stdin") && first + 1 < argc)
+            {
+                string file = argv[++first];
+                if (access(file.c_str(), R_OK) == -1 || file.find(' ') != string::npos || file.back() == '/')
+                {
+                    cerr << "Cannot upload " << file << ", it must be a readable file without spaces in its name" << endl;
+                    return EXIT_FAILURE;
+                }
+                if (option == "--input")
+                {
+                    options.Inputs.push_back(file);
+                }
+                else
+                {
+                    options.StdinInput = file;
+                }
+            }
+            else
+            {
+                cerr << "Unknown issueJob option: " << option << endl;
+                return EXIT_FAILURE;
+            }
+        }
+
         string job;
-        for (int i = 4; i < argc; i++)
+        for (int i = first; i < argc; i++)
         {
             job += string(argv[i]) + " ";
         }
-        commander.IssueJob(job);
+        if (job.empty())
+        {
+            cerr << "issueJob requires a command." << endl;
+            return EXIT_FAILURE;
+        }
+        commander.IssueJob(job, options);
     }
-    else if (command == "setConcurrency" && argc == 5)
+    else if (command == "setConcurrency" && argCount == 1)
     {
-        auto level = stoi(argv[4]);
+        auto level = stoi(argv[commandIndex + 1]);
         commander.SetConcurrency(level);
     }
-    else if (command == "stop" && argc == 5)
+    else if (command == "stop" && argCount == 1)
     {
-        string jobId = argv[4];
+        string jobId = argv[commandIndex + 1];
         commander.StopJob(jobId);
     }
-    else if (command == "poll" && argc == 4)
+    else if (command == "poll" && argCount <= 1)
+    {
+        commander.PollJobs(argCount == 1 ? argv[commandIndex + 1] : "");
+    }
+    else if (command == "watch" && argCount == 0)
+    {
+        commander.WatchJobs();
+    }
+    else if (command == "trace" && argCount <= 1)
+    {
+        commander.Trace(argCount == 1 ? argv[commandIndex + 1] : "");
+    }
+    else if (command == "stats" && argCount == 0)
+    {
+        commander.ShowStats();
+    }
+    else if (command == "restart" && argCount == 0)
     {
-        commander.PollJobs();
+        commander.Restart();
     }
-    else if (command == "exit" && argc == 4)
+    else if (command == "exit" && argCount == 0)
     {
         commander.ExitServer();
     }
@@ -47,10 +138,14 @@ int main(int argc, char* argv[])
     {
         cerr << "Invalid command or wrong number of arguments." << endl;
         cerr << "Usage examples:" << endl;
-        cerr << argv[0] << " issueJob <command>" << endl;
+        cerr << argv[0] << " issueJob [--compress] [--passfd] [--least-loaded] [--short] [--after|--afterany <jobId>[,...]] [--timeout <s>] [--deadline <s>] [--input <file>]... [--stdin <file>] <command>" << endl;
         cerr << argv[0] << " setConcurrency <level>" << endl;
         cerr << argv[0] << " stop <jobId>" << endl;
-        cerr << argv[0] << " poll [running|queued]" << endl;
+        cerr << argv[0] << " poll [running|queued|blocked]" << endl;
+        cerr << argv[0] << " watch" << endl;
+        cerr << argv[0] << " trace [on|off]" << endl;
+        cerr << argv[0] << " stats" << endl;
+        cerr << argv[0] << " restart" << endl;
         cerr << argv[0] << " exit" << endl;
         return EXIT_FAILURE;
     }
@@ -1,12 +1,15 @@
 #include "Server.h"
 #include <iostream>
+#include <cstdio>
+#include <fcntl.h>
 using namespace std;
 
 int main(int argc, char* argv[])
 {
-    if (argc != 4)
+    if (argc < 4)
     {
-        cerr << "Usage: " << argv[0] << " <portnum> <bufferSize> <threadPoolSize>" << endl;
+        cerr << "Usage: " << argv[0] << " <portnum> <bufferSize> <threadPoolSize> [--unix <path>] [--acceptors <n>] [--backlog <n>]"
+             << " [--batch <jobs>] [--batch-window <ms>] [--pin <cpus>] [--kill-grace <ms>] [--trace] [--io-uring] [--shard <name>] [--peers <host:port>,...]" << endl;
         return EXIT_FAILURE;
     }
 
@@ -25,7 +28,104 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
 
-    Server server(port, bufferSize, threadPoolSize);
+    ServerOptions options;
+    for (int i = 4; i < argc; i++)
+    {
+        string option = argv[i];
+        if (option == "--takeover" && i + 1 < argc) // Added by a hot restart
+        {
+            options.TakeoverFD = stoi(argv[++i]);
+        }
+        else if (option == "--unix" && i + 1 < argc)
+        {
+            options.UnixPath = argv[++i];
+        }
+        else if (option == "--acceptors" && i + 1 < argc)
+        {
+            options.Acceptors = stoi(argv[++i]);
+        }
+        else if (option == "--backlog" && i + 1 < argc)
+        {
+            options.Backlog = stoi(argv[++i]);
+        }
+        else if (option == "--batch" && i + 1 < argc)
+        {
+            options.BatchSize = stoi(argv[++i]);
+        }
+        else if (option == "--batch-window" && i + 1 < argc)
+        {
+            options.BatchWindowMs = stoi(argv[++i]);
+        }
+        else if (option == "--kill-grace" && i + 1 < argc)
+        {
+            options.KillGraceMs = stoi(argv[++i]);
+        }
+        else if (option == "--trace")
+        {
+            options.Trace = true;
+        }
+        else if (option == "--io-uring")
+        {
+            options.IoUring = true;
+        }
+        else if (option == "--pin" && i + 1 < argc)
+        {
+            options.PinCpus = stoi(argv[++i]);
+        }
+        else if (option == "--shard" && i + 1 < argc)
+        {
+            options.ShardName = argv[++i];
+        }
+        else if (option == "--peers" && i + 1 < argc)
+        {
+            string peers = argv[++i];
+            size_t start = 0;
+            while (start < peers.length())
+            {
+                size_t end = peers.find(',', start);
+                string peer = peers.substr(start, end == string::npos ? string::npos : end - start);
+                string host;
+                string peerPort;
+                if (!Transport::SplitHostPort(peer, "", host, peerPort))
+                {
+                    cerr << "Error: peers must be given as host:port" << endl;
+                    return EXIT_FAILURE;
+                }
+                options.Peers.push_back(peer);
+                start = (end == string::npos) ? peers.length() : end + 1;
+            }
+        }
+        else
+        {
+            cerr << "Error: unknown option " << option << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.Acceptors <= 0 || options.Backlog <= 0 || options.BatchSize <= 0 || options.BatchWindowMs < 0 || options.PinCpus < 0 || options.KillGraceMs < 0)
+    {
+        cerr << "Error: acceptors, backlog and batch size must be positive integers." << endl;
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < argc; i++) // Kept for the next hot restart, without our own --takeover
+    {
+        if (string(argv[i]) == "--takeover")
+        {
+            i++;
+            continue;
+        }
+        options.Arguments.push_back(argv[i]);
+    }
+
+    // The takeover channel was inherited across exec, the zygote forked by Server must not inherit it again
+    if (options.TakeoverFD >= 0 && fcntl(options.TakeoverFD, F_SETFD, FD_CLOEXEC) == -1)
+    {
+        perror("takeover channel");
+        return EXIT_FAILURE;
+    }
+
+    Server server(port, bufferSize, threadPoolSize, options);
     server.Start();
 
     return EXIT_SUCCESS;
@@ -1,4 +1,5 @@
 #include "Server.h"
+#include "Tracer.h"
 #include <iostream>
 #include <unistd.h>
 #include <sys/wait.h>
@@ -9,15 +10,56 @@
 #include <algorithm>
 #include <tuple>
 #include <string>
+#include <sstream>
+#include <iomanip>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <poll.h>
+#include <ftw.h>
+#include <climits>
+#include <sys/stat.h>
 using namespace std;
 
-Server::Server(int port, int bufferSize, int threadPoolSize)
-    : Port(port), BufferSize(bufferSize), ThreadPoolSize(threadPoolSize), 
-      ConcurrencyLevel(1), IsRunning(true), JobCounter(0), ActiveWorkers(0)
+static const size_t WatchBufferSize = 256; // Events a watcher may fall behind before it is resynced
+static const int WatchPollIntervalMs = 1000;
+static const int WatchDrainGraceMs = 2000; // Watchers get this long to flush their last events at shutdown
+static const size_t FinishedJobsKept = 65536; // Exit statuses remembered for dependency checks
+static const uint64_t TimerTickMs = 10;
+static const size_t TimerSlots = 512; // One turn of the wheel covers about five seconds
+static const int HandoffTimeoutMs = 10000; // How long a hot restart waits for the new server
+
+Server::Server(int port, int bufferSize, int threadPoolSize, const ServerOptions& options)
+    : Port(port), Options(options), BufferSize(bufferSize), ThreadPoolSize(threadPoolSize), 
+      ConcurrencyLevel(1), IsRunning(true), JobCounter(0), ActiveWorkers(0),
+      CompressedTransfers(0), OutputBytesRaw(0), OutputBytesSent(0), Events(WatchBufferSize),
+      Timers(TimerTickMs, TimerSlots), NoticesClosed(false), HandedOff(false), RestartPending(false), HandoffFD(-1)
 {
     pthread_mutex_init(&QueueMutex, nullptr);
+    pthread_mutex_init(&StatsMutex, nullptr);
+    pthread_mutex_init(&KillMutex, nullptr);
+    pthread_mutex_init(&HandoffMutex, nullptr);
+    pthread_mutex_init(&NoticeMutex, nullptr);
     pthread_cond_init(&JobAvailable, nullptr);
     pthread_cond_init(&SpaceAvailable, nullptr);
+    pthread_cond_init(&NoticeAvailable, nullptr);
+
+    Tracer::SetEnabled(Options.Trace);
+    IoUring::SetEnabled(Options.IoUring);
+    Topology.Discover();
+    ConcurrencyLevel = Topology.GetDefaultConcurrency();
+    cout << "Found " << Topology.Describe() << ", default concurrency " << ConcurrencyLevel << endl;
+
+    // Fork the launcher while the server is still single-threaded and has no sockets open
+    if (!Launcher.Start())
+    {
+        cerr << "Failed to start the zygote, jobs will be forked from the server" << endl;
+    }
+    if (!Timers.Start())
+    {
+        cerr << "Failed to start the timer thread, job deadlines and timeouts are not enforced" << endl;
+    }
+    pthread_create(&NoticeThread, nullptr, &Server::NoticeThreadFunction, this);
 
     WorkerThreads.reserve(threadPoolSize);
     for (int i = 0; i < threadPoolSize; i++)
@@ -35,31 +77,97 @@ Server::~Server()
     {
         pthread_join(thread, nullptr);
     }
+    Timers.Stop();
+    pthread_mutex_lock(&NoticeMutex);
+    NoticesClosed = true; // Workers and timers are gone, nothing queues notices any more
+    pthread_cond_signal(&NoticeAvailable);
+    pthread_mutex_unlock(&NoticeMutex);
+    pthread_join(NoticeThread, nullptr);
+    Events.WaitForSubscribers(WatchDrainGraceMs);
+    if (HandoffFD >= 0)
+    {
+        close(HandoffFD);
+    }
 
     pthread_mutex_destroy(&QueueMutex);
+    pthread_mutex_destroy(&StatsMutex);
+    pthread_mutex_destroy(&KillMutex);
+    pthread_mutex_destroy(&HandoffMutex);
+    pthread_mutex_destroy(&NoticeMutex);
     pthread_cond_destroy(&JobAvailable);
     pthread_cond_destroy(&SpaceAvailable);
+    pthread_cond_destroy(&NoticeAvailable);
 }
 
 void Server::Start()
 {
-    if (!SocketController.SetupServer(to_string(Port)))
+    if (Options.TakeoverFD >= 0)
+    {
+        if (!AdoptState())
+        {
+            cerr << "Failed to take over from the previous server" << endl;
+            exit(EXIT_FAILURE); // It keeps running, and our half adopted state must not answer its clients
+        }
+        pthread_create(&HandoffThread, nullptr, &Server::HandoffThreadFunction, this);
+    }
+    else if (!SocketController.SetupServer(to_string(Port), Options.Acceptors, Options.Backlog))
     {
         cerr << "Failed to setup server on port " << Port << endl;
         return;
     }
+    else if (!Options.UnixPath.empty() && !SocketController.SetupUnixServer(Options.UnixPath, Options.Backlog))
+    {
+        cerr << "Failed to setup server on unix socket " << Options.UnixPath << endl;
+        return;
+    }
 
-    while (IsRunning)
+    vector<pthread_t> acceptorThreads;
+    for (size_t i = 0; i < SocketController.GetListenerCount(); i++)
     {
-        int clientSocket = SocketController.AcceptConnection();
-        if (clientSocket >= 0)
+        AcceptorArgs* args = new AcceptorArgs{ this, i };
+        pthread_t acceptorThread;
+        pthread_create(&acceptorThread, nullptr, &Server::AcceptorThreadFunction, args);
+        acceptorThreads.push_back(acceptorThread);
+    }
+    for (auto& thread : acceptorThreads)
+    {
+        pthread_join(thread, nullptr);
+    }
+    if (HandedOff)
+    {
+        SocketController.ReleaseListeners(); // The new server still listens on them
+    }
+    if (Options.TakeoverFD >= 0)
+    {
+        shutdown(Options.TakeoverFD, SHUT_RDWR); // Stop listening to a server that is still draining
+        pthread_join(HandoffThread, nullptr);
+        close(Options.TakeoverFD);
+    }
+}
+
+void* Server::AcceptorThreadFunction(void* arg)
+{
+    AcceptorArgs* args = static_cast<AcceptorArgs*>(arg);
+    Server* serverInstance = args->ServerInstance;
+    size_t listener = args->Listener;
+    delete args;
+
+    while (serverInstance->IsRunning)
+    {
+        int clientSocket = serverInstance->SocketController.AcceptConnection(listener);
+        if (clientSocket >= 0 && serverInstance->HandedOff)
+        {
+            serverInstance->HandOffClient(clientSocket);
+        }
+        else if (clientSocket >= 0)
         {
-            ClientHandlerArgs* args = new ClientHandlerArgs{ this, clientSocket };
+            ClientHandlerArgs* clientArgs = new ClientHandlerArgs{ serverInstance, clientSocket };
             pthread_t clientThread;
-            pthread_create(&clientThread, nullptr, &Server::HandleClient, args);
+            pthread_create(&clientThread, nullptr, &Server::HandleClient, clientArgs);
             pthread_detach(clientThread);
         }
     }
+    return nullptr;
 }
 
 void* Server::HandleClient(void* arg)
@@ -69,34 +177,28 @@ void* Server::HandleClient(void* arg)
     int clientSocket = args->ClientSocket;
     delete args;
 
+    TraceScope trace("HandleClient");
     string command;
     if (serverInstance->SocketController.ReceiveMessage(clientSocket, command))
     {
         if (command.find("issueJob") == 0)
         {
-            string job = command.substr(9);
-            string jobID = "job_" + to_string(serverInstance->JobCounter++);
+            string spec = command.substr(9);
+            Job job;
+            job.ID = serverInstance->NextJobID();
+            job.ClientSocket = clientSocket;
+            if (!serverInstance->ParseJobOptions(spec, job))
             {
-                pthread_mutex_lock(&serverInstance->QueueMutex);
-                while ((int)serverInstance->JobQueue.size() >= serverInstance->BufferSize)
-                {
-                    pthread_cond_wait(&serverInstance->SpaceAvailable, &serverInstance->QueueMutex);
-                }
-                if (!serverInstance->IsRunning)
-                {
-                    pthread_mutex_unlock(&serverInstance->QueueMutex);
-                    close(clientSocket);
-                    return nullptr;
-                }
-                serverInstance->JobQueue.emplace(jobID, job, clientSocket);
-                string response = "JOB " + jobID + ", " + job + " SUBMITTED\n";
-                if (clientSocket >= 0)
+                if (job.OutputFD >= 0)
                 {
-                    serverInstance->SocketController.SendMessage(clientSocket, response);
+                    close(job.OutputFD);
                 }
-                pthread_cond_signal(&serverInstance->JobAvailable);
-                pthread_mutex_unlock(&serverInstance->QueueMutex);
+                serverInstance->DiscardInputs(job);
+                serverInstance->SocketController.SendMessage(clientSocket, "Error: Invalid job options\n");
+                close(clientSocket);
+                return nullptr;
             }
+            serverInstance->AdmitJob(job, spec);
         }
         else if (command.find("setConcurrency") == 0)
         {
@@ -117,17 +219,65 @@ void* Server::HandleClient(void* arg)
         }
         else if (command.find("poll") == 0)
         {
+            string filter = command.substr(4);
+            filter.erase(0, filter.find_first_not_of(' '));
             pthread_mutex_lock(&serverInstance->QueueMutex);
-            queue<tuple<string, string, int>> tempQueue = serverInstance->JobQueue;
-            pthread_mutex_unlock(&serverInstance->QueueMutex);
-            
             string response;
-            while (!tempQueue.empty())
+            if (filter == "running")
+            {
+                response = serverInstance->BuildRunningList();
+            }
+            else if (filter == "blocked")
+            {
+                response = serverInstance->BuildBlockedList();
+            }
+            else
+            {
+                response = serverInstance->BuildSnapshot();
+            }
+            pthread_mutex_unlock(&serverInstance->QueueMutex);
+
+            if (clientSocket >= 0)
+            {
+                serverInstance->SocketController.SendMessage(clientSocket, response);
+            }
+            close(clientSocket);
+        }
+        else if (command.find("watch") == 0)
+        {
+            serverInstance->WatchJobs(clientSocket);
+            close(clientSocket);
+        }
+        else if (command.find("trace") == 0)
+        {
+            string response = serverInstance->HandleTrace(command.substr(5));
+            if (clientSocket >= 0)
+            {
+                serverInstance->SocketController.SendMessage(clientSocket, response);
+            }
+            close(clientSocket);
+        }
+        else if (command.find("load") == 0)
+        {
+            string response = serverInstance->GetLoad();
+            if (clientSocket >= 0)
+            {
+                serverInstance->SocketController.SendMessage(clientSocket, response);
+            }
+            close(clientSocket);
+        }
+        else if (command.find("stats") == 0)
+        {
+            string response = serverInstance->GetStats();
+            if (clientSocket >= 0)
             {
-                auto job = tempQueue.front();
-                response += get<0>(job) + ", " + get<1>(job) + "\n";
-                tempQueue.pop();
+                serverInstance->SocketController.SendMessage(clientSocket, response);
             }
+            close(clientSocket);
+        }
+        else if (command.find("restart") == 0)
+        {
+            string response = serverInstance->HotRestart();
             if (clientSocket >= 0)
             {
                 serverInstance->SocketController.SendMessage(clientSocket, response);
@@ -157,14 +307,21 @@ void* Server::HandleClient(void* arg)
 void* Server::WorkerThreadFunction(void* arg)
 {
     Server* serverInstance = static_cast<Server*>(arg);
+    IoUring::AllowForThisThread(); // Workers send the job output, client threads stay on blocking calls
+    IoUring::ForThread(); // Set the ring up now rather than in the middle of a job's output
 
     while (serverInstance->IsRunning)
     {
-        tuple<string, string, int> job;
+        vector<Job> batch;
+        vector<int> cpus;
         {
-            pthread_mutex_lock(&serverInstance->QueueMutex);
+            {
+                TraceScope lockTrace("QueueMutex wait");
+                pthread_mutex_lock(&serverInstance->QueueMutex);
+            }
             while ((serverInstance->JobQueue.empty() || serverInstance->ActiveWorkers >= serverInstance->ConcurrencyLevel) && serverInstance->IsRunning)
             {
+                TraceScope idleTrace("Worker idle");
                 pthread_cond_wait(&serverInstance->JobAvailable, &serverInstance->QueueMutex);
             }
             if (!serverInstance->IsRunning)
@@ -173,97 +330,380 @@ void* Server::WorkerThreadFunction(void* arg)
                 return nullptr;
             }
 
-            job = serverInstance->JobQueue.front();
-            serverInstance->JobQueue.pop();
+            batch.push_back(serverInstance->JobQueue.front());
+            serverInstance->JobQueue.pop_front();
+            if (batch.front().Deadline != 0 && TimerWheel::NowMs() >= batch.front().Deadline)
+            {
+                serverInstance->MissDeadline(batch.front()); // Too late to start, the slot goes to the next job
+                pthread_mutex_unlock(&serverInstance->QueueMutex);
+                continue;
+            }
             serverInstance->ActiveWorkers++;
-            pthread_cond_signal(&serverInstance->SpaceAvailable);
+            if (serverInstance->Options.BatchSize > 1 && serverInstance->IsBatchable(batch.front()))
+            {
+                serverInstance->CollectBatch(batch);
+            }
+            if (serverInstance->Options.PinCpus > 0)
+            {
+                cpus = serverInstance->Topology.Acquire(serverInstance->Options.PinCpus);
+            }
+            string placement = serverInstance->Topology.DescribePlacement(cpus);
+            uint64_t now = Tracer::IsEnabled() ? Tracer::Now() : 0;
+            for (const auto& job : batch)
+            {
+                if (now != 0 && job.SubmitTime != 0)
+                {
+                    Tracer::Record("Queue wait", job.SubmitTime, now);
+                }
+                serverInstance->RunningJobs[job.ID] = RunningJob{ job.Command, cpus };
+                serverInstance->Events.Publish("STARTED " + job.ID + ", " + placement);
+            }
+            pthread_cond_broadcast(&serverInstance->SpaceAvailable);
             pthread_mutex_unlock(&serverInstance->QueueMutex);
         }
 
-        serverInstance->ProcessJob(get<2>(job), get<1>(job), get<0>(job));
+        vector<int> statuses;
+        if (batch.size() == 1)
+        {
+            statuses.push_back(serverInstance->ProcessJob(batch.front(), cpus));
+        }
+        else
+        {
+            statuses = serverInstance->ProcessBatch(batch, cpus);
+        }
 
-        pthread_mutex_lock(&serverInstance->QueueMutex);
+        {
+            TraceScope lockTrace("QueueMutex wait");
+            pthread_mutex_lock(&serverInstance->QueueMutex);
+        }
         serverInstance->ActiveWorkers--;
+        serverInstance->Topology.Release(cpus);
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            serverInstance->RunningJobs.erase(batch[i].ID);
+            serverInstance->Events.Publish("FINISHED " + batch[i].ID + ", exit " + to_string(statuses[i]));
+            serverInstance->CompleteJob(batch[i].ID, statuses[i]);
+            if (serverInstance->HandedOff) // Its dependents live in the new server now
+            {
+                serverInstance->SendHandoff("FINISHED " + batch[i].ID + " " + to_string(statuses[i]), {});
+            }
+        }
+        if (serverInstance->HandedOff && serverInstance->ActiveWorkers == 0)
+        {
+            serverInstance->FinishDrain();
+        }
         pthread_cond_signal(&serverInstance->JobAvailable);
         pthread_mutex_unlock(&serverInstance->QueueMutex);
     }
     return nullptr;
 }
 
-void Server::ProcessJob(int clientSocket, const string& job, const string& jobID)
+// Blocks the job on its parents or queues it, waiting for buffer space or overflowing to a peer
+void Server::AdmitJob(Job& job, const string& spec)
 {
-    pid_t pid = fork();
-    if (pid == 0)
+    int clientSocket = job.ClientSocket;
+    job.SubmitTime = Tracer::IsEnabled() ? Tracer::Now() : 0;
     {
-        string outputFile = to_string(getpid()) + ".output";
-        int fd = open(outputFile.c_str(), O_WRONLY | O_CREAT, 0666);
-        if (fd == -1)
-        {
-            perror("Failed to open output file");
-            exit(EXIT_FAILURE);
-        }
-        if (dup2(fd, STDOUT_FILENO) == -1)
+        TraceScope lockTrace("QueueMutex wait");
+        pthread_mutex_lock(&QueueMutex);
+    }
+    if (HandedOff) // Raced with a hot restart, the new process takes it from here
+    {
+        pthread_mutex_unlock(&QueueMutex);
+        HandOffJob(job, spec);
+        return;
+    }
+    bool canForward = !spec.empty() && !job.Forwarded && job.OutputFD < 0 && job.After.empty() && job.InputDir.empty() && !Options.Peers.empty();
+    // Blocked jobs hold their place in the buffer too, releasing them then never overfills the queue
+    while ((int)(JobQueue.size() + BlockedJobs.size()) >= BufferSize && IsRunning && !HandedOff)
+    {
+        if (canForward) // Offer the overflow to a peer once before blocking
         {
-            perror("Failed to duplicate file descriptor to STDOUT");
-            close(fd);
-            exit(EXIT_FAILURE);
+            canForward = false;
+            pthread_mutex_unlock(&QueueMutex);
+            if (ForwardJob(job, spec))
+            {
+                close(clientSocket);
+                return;
+            }
+            pthread_mutex_lock(&QueueMutex);
+            continue;
         }
-        if (dup2(fd, STDERR_FILENO) == -1)
+        TraceScope bufferTrace("Buffer full wait");
+        pthread_cond_wait(&SpaceAvailable, &QueueMutex);
+    }
+    if (HandedOff)
+    {
+        pthread_mutex_unlock(&QueueMutex);
+        HandOffJob(job, spec);
+        return;
+    }
+    if (!IsRunning) // Lost the race with exit, answer like the jobs that were already queued
+    {
+        pthread_mutex_unlock(&QueueMutex);
+        if (job.OutputFD >= 0)
         {
-            perror("Failed to duplicate file descriptor to STDERR");
-            close(fd);
-            exit(EXIT_FAILURE);
+            close(job.OutputFD);
         }
-        close(fd);
-        execlp("/bin/sh", "sh", "-c", job.c_str(), nullptr);
-        perror("Failed to execute command");
-        exit(EXIT_FAILURE);
+        DiscardInputs(job);
+        SocketController.SendMessage(clientSocket, "SERVER TERMINATED BEFORE EXECUTION");
+        close(clientSocket);
+        return;
     }
-    else if (pid > 0)
+    ScheduleExpiry(job);
+    if (!job.After.empty())
     {
-        int status;
-        waitpid(pid, &status, 0); // Wait for child process to finish
-
-        string outputFile = to_string(pid) + ".output";
-        if (clientSocket >= 0)
+        string error;
+        bool blocked = BlockOnParents(job, error);
+        if (!error.empty())
         {
-            string responseHeader = "-----" + jobID + " output start------\n";
-            SocketController.SendMessage(clientSocket, responseHeader);
-            if (!SocketController.SendFileData(clientSocket, outputFile))
+            pthread_mutex_unlock(&QueueMutex);
+            SocketController.SendMessage(clientSocket, error);
+            if (job.OutputFD >= 0)
             {
-                cerr << "Failed to send file data." << endl;
+                close(job.OutputFD);
             }
-            string responseFooter = "-----" + jobID + " output end------\n";
-            SocketController.SendMessage(clientSocket, responseFooter);
-            
+            DiscardInputs(job);
             close(clientSocket);
+            return;
         }
-        remove(outputFile.c_str());
+        if (blocked) // Released by CompleteJob once the parents are done
+        {
+            string response = "JOB " + job.ID + ", " + job.Command + " SUBMITTED\n";
+            SocketController.SendMessage(clientSocket, response);
+            pthread_mutex_unlock(&QueueMutex);
+            return;
+        }
+    }
+    EnqueueJob(job);
+    Events.Publish("SUBMITTED " + job.ID + ", " + job.Command);
+    string response = "JOB " + job.ID + ", " + job.Command + " SUBMITTED\n";
+    if (clientSocket >= 0)
+    {
+        SocketController.SendMessage(clientSocket, response);
+    }
+    pthread_cond_signal(&JobAvailable);
+    pthread_mutex_unlock(&QueueMutex);
+}
+
+// Returns the exit code of the job, -1 if it could not be started
+int Server::ProcessJob(const Job& job, const vector<int>& cpus)
+{
+    TraceScope trace("ProcessJob");
+    int clientSocket = job.ClientSocket;
+    const string& jobID = job.ID;
+    string outputFile = to_string(getpid()) + "." + jobID + ".output";
+    int outputFD = (job.OutputFD >= 0) ? job.OutputFD : open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (outputFD == -1)
+    {
+        perror("Failed to open output file");
+    }
+
+    string command = job.Command;
+    if (!job.InputDir.empty())
+    {
+        command = "export JOB_INPUT_DIR=" + ShellQuote(job.InputDir) + "; " + command;
+    }
+    int inputFD = job.StdinFile.empty() ? -1 : open(job.StdinFile.c_str(), O_RDONLY | O_CLOEXEC);
+
+    bool fromZygote = false;
+    pid_t pid = (outputFD >= 0) ? LaunchJob(command, outputFD, inputFD, cpus, fromZygote) : -1;
+    if (outputFD >= 0)
+    {
+        close(outputFD); // The job holds its own copy now
+    }
+    if (inputFD >= 0)
+    {
+        close(inputFD);
+    }
+
+    int exitCode = -1;
+    if (pid > 0)
+    {
+        ArmKillTimer(pid, job);
+        int status;
+        bool exited = WaitJob(pid, fromZygote, status); // Wait for child process to finish
+        bool timedOut = DisarmKillTimer(pid);
+        if (exited)
+        {
+            exitCode = ExitCode(status);
+        }
+        SendJobOutput(job, outputFile, timedOut);
     }
     else
     {
-        cerr << "Error: fork() failed to create a new process for job: " << job << endl;
-        string response = "Error: Unable to execute job: " + job + "\n";
+        cerr << "Error: fork() failed to create a new process for job: " << job.Command << endl;
+        string response = "Error: Unable to execute job: " + job.Command + "\n";
         if (clientSocket >= 0)
         {
             SocketController.SendMessage(clientSocket, response);
         }
         close(clientSocket);
     }
+
+    if (job.OutputFD < 0)
+    {
+        remove(outputFile.c_str());
+    }
+    DiscardInputs(job);
+    return exitCode;
+}
+
+// Runs a batch of short jobs one after the other in a single shell, each into its own output file
+vector<int> Server::ProcessBatch(const vector<Job>& batch, const vector<int>& cpus)
+{
+    TraceScope trace("ProcessBatch");
+    string script;
+    vector<string> outputFiles;
+    for (const auto& job : batch)
+    {
+        outputFiles.push_back(to_string(getpid()) + "." + job.ID + ".output");
+        // eval keeps a syntax error in one job from breaking the rest of the script,
+        // and the script's own stdout collects one exit code per job
+        script += "( eval " + ShellQuote(job.Command) + " ) > " + ShellQuote(outputFiles.back()) + " 2>&1; echo $?\n";
+    }
+
+    string statusFile = to_string(getpid()) + "." + batch.front().ID + ".status";
+    int outputFD = open(statusFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    bool fromZygote = false;
+    pid_t pid = (outputFD >= 0) ? LaunchJob(script, outputFD, -1, cpus, fromZygote) : -1;
+    if (outputFD >= 0)
+    {
+        close(outputFD);
+    }
+
+    int status;
+    vector<int> exitCodes(batch.size(), -1);
+    if (pid > 0)
+    {
+        WaitJob(pid, fromZygote, status);
+        ifstream statuses(statusFile);
+        for (size_t i = 0; i < batch.size() && statuses >> exitCodes[i]; i++)
+        {
+        }
+    }
+    remove(statusFile.c_str());
+
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        if (pid > 0)
+        {
+            SendJobOutput(batch[i], outputFiles[i], false);
+        }
+        else
+        {
+            string response = "Error: Unable to execute job: " + batch[i].Command + "\n";
+            SocketController.SendMessage(batch[i].ClientSocket, response);
+            close(batch[i].ClientSocket);
+        }
+        remove(outputFiles[i].c_str());
+    }
+    return exitCodes;
+}
+
+void Server::SendJobOutput(const Job& job, const string& outputFile, bool timedOut)
+{
+    TraceScope trace("Send output");
+    int clientSocket = job.ClientSocket;
+    const string& jobID = job.ID;
+    if (clientSocket >= 0)
+    {
+        string responseHeader = "-----" + jobID + " output start------\n";
+        SocketController.SendMessage(clientSocket, responseHeader);
+        if (job.OutputFD >= 0)
+        {
+            // The job wrote straight into the client's stdout, there is nothing to transfer
+        }
+        else if (job.Compress)
+        {
+            uint64_t rawBytes = 0;
+            uint64_t sentBytes = 0;
+            if (!SocketController.SendCompressedFileData(clientSocket, outputFile, rawBytes, sentBytes))
+            {
+                cerr << "Failed to send compressed file data." << endl;
+            }
+            pthread_mutex_lock(&StatsMutex);
+            CompressedTransfers++;
+            OutputBytesRaw += rawBytes;
+            OutputBytesSent += sentBytes;
+            pthread_mutex_unlock(&StatsMutex);
+        }
+        else if (!SocketController.SendFileData(clientSocket, outputFile))
+        {
+            cerr << "Failed to send file data." << endl;
+        }
+        string responseFooter = "-----" + jobID + " output end------\n";
+        if (timedOut)
+        {
+            responseFooter += "JOB " + jobID + " TIMED OUT\n";
+        }
+        SocketController.SendMessage(clientSocket, responseFooter);
+        
+        close(clientSocket);
+    }
+}
+
+// Spawns through the zygote when it is up, otherwise forks the server itself
+pid_t Server::LaunchJob(const string& command, int outputFD, int inputFD, const vector<int>& cpus, bool& fromZygote)
+{
+    TraceScope trace("Spawn");
+    fromZygote = false;
+    if (Launcher.IsRunning())
+    {
+        bool mayHaveStarted = false;
+        pid_t pid = Launcher.Spawn(command, outputFD, inputFD, cpus, mayHaveStarted);
+        if (pid > 0)
+        {
+            fromZygote = true;
+            return pid;
+        }
+        if (mayHaveStarted) // Forking it here as well could run the job twice
+        {
+            return -1;
+        }
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        Zygote::RunChild(command, outputFD, inputFD, cpus);
+    }
+    return pid;
+}
+
+bool Server::WaitJob(pid_t pid, bool fromZygote, int& status)
+{
+    TraceScope trace("Job run");
+    if (fromZygote)
+    {
+        return Launcher.Wait(pid, status);
+    }
+    return waitpid(pid, &status, 0) == pid;
 }
 
 void Server::HandleRemainingJobs()
 {
+    for (auto& blocked : BlockedJobs)
+    {
+        JobQueue.push_back(blocked.second.Entry);
+    }
+    BlockedJobs.clear();
+
     while (!JobQueue.empty())
     {
         auto job = JobQueue.front();
-        JobQueue.pop();
+        JobQueue.pop_front();
 
         string response = "SERVER TERMINATED BEFORE EXECUTION";
-        if (get<2>(job) >= 0)
+        if (job.OutputFD >= 0)
+        {
+            close(job.OutputFD);
+        }
+        DiscardInputs(job);
+        if (job.ClientSocket >= 0)
         {
-            SocketController.SendMessage(get<2>(job), response);
-            close(get<2>(job));
+            SocketController.SendMessage(job.ClientSocket, response);
+            close(job.ClientSocket);
         }
     }
 }
@@ -272,6 +712,7 @@ void Server::SetConcurrency(int newLevel)
 {
     pthread_mutex_lock(&QueueMutex);
     ConcurrencyLevel = newLevel;
+    Events.Publish("CONCURRENCY " + to_string(newLevel));
     pthread_cond_broadcast(&JobAvailable);
     pthread_mutex_unlock(&QueueMutex);
 }
@@ -284,8 +725,13 @@ void Server::StopServer()
         IsRunning = false;
         pthread_cond_broadcast(&JobAvailable);
         HandleRemainingJobs();
+        Events.Publish("SERVER TERMINATED");
+        Events.Close();
         pthread_cond_broadcast(&SpaceAvailable);
-        SocketController.CloseServerSocket();
+        if (!HandedOff) // Shutting down a listener we handed off would stop the new server too
+        {
+            SocketController.CloseServerSocket();
+        }
         cout << "SERVER TERMINATED" << endl;
     }
     pthread_mutex_unlock(&QueueMutex);
@@ -294,41 +740,57 @@ void Server::StopServer()
 void Server::RemoveJob(const string& jobID, int clientSocket)
 {
     pthread_mutex_lock(&QueueMutex);
-    queue<tuple<string, string, int>> tempQueue;
+    deque<Job> tempQueue;
     bool found = false;
+
+    auto blocked = BlockedJobs.find(jobID);
+    if (blocked != BlockedJobs.end())
+    {
+        JobQueue.push_front(blocked->second.Entry); // Removed below like any queued job
+        BlockedJobs.erase(blocked);
+    }
     
     while (!JobQueue.empty())
     {
         auto job = JobQueue.front();
-        JobQueue.pop();
+        JobQueue.pop_front();
         
-        if (get<0>(job) == jobID)
+        if (job.ID == jobID)
         {
             string response = "JOB " + jobID + " REMOVED\n";
+            Events.Publish("REMOVED " + jobID);
             if (clientSocket >= 0)
             {
                 SocketController.SendMessage(clientSocket, response);
             }
-            close(clientSocket);
-            if (get<2>(job) >= 0)
+            if (job.ClientSocket >= 0)
+            {
+                SocketController.SendMessage(job.ClientSocket, response);
+            }
+            close(job.ClientSocket);
+            if (job.OutputFD >= 0)
             {
-                SocketController.SendMessage(get<2>(job), response);
+                close(job.OutputFD);
             }
-            close(get<2>(job));
+            DiscardInputs(job);
             found = true;
             pthread_cond_signal(&SpaceAvailable);
             break;
         }
         else
         {
-            tempQueue.push(job);
+            tempQueue.push_back(job);
         }
     }
     
     while (!tempQueue.empty()) // Put the remaining jobs back in the original queue
     {
-        JobQueue.push(tempQueue.front());
-        tempQueue.pop();
+        JobQueue.push_front(tempQueue.back());
+        tempQueue.pop_back();
+    }
+    if (found)
+    {
+        CompleteJob(jobID, -1);
     }
     
     if (!found)
@@ -342,3 +804,1106 @@ void Server::RemoveJob(const string& jobID, int clientSocket)
     
     pthread_mutex_unlock(&QueueMutex);
 }
+
+// Consumes the leading "--option" tokens of an issueJob request, the rest is the job command
+bool Server::ParseJobOptions(const string& spec, Job& job)
+{
+    size_t position = 0;
+    while (spec.compare(position, 2, "--") == 0)
+    {
+        size_t end = spec.find(' ', position);
+        string option = spec.substr(position, end == string::npos ? string::npos : end - position);
+        if (option == "--compress")
+        {
+            job.Compress = true;
+        }
+        else if (option == "--short")
+        {
+            job.Short = true;
+        }
+        else if (option == "--forwarded")
+        {
+            job.Forwarded = true;
+        }
+        else if ((option == "--after" || option == "--afterok" || option == "--afterany") && end != string::npos)
+        {
+            size_t listEnd = spec.find(' ', end + 1);
+            string parents = spec.substr(end + 1, listEnd == string::npos ? string::npos : listEnd - end - 1);
+            size_t start = 0;
+            while (start < parents.length())
+            {
+                size_t comma = parents.find(',', start);
+                string parent = parents.substr(start, comma == string::npos ? string::npos : comma - start);
+                if (!parent.empty())
+                {
+                    job.After.push_back(parent);
+                }
+                start = (comma == string::npos) ? parents.length() : comma + 1;
+            }
+            job.AfterAny = (option == "--afterany");
+            end = listEnd;
+        }
+        else if ((option == "--timeout" || option == "--deadline") && end != string::npos)
+        {
+            size_t valueEnd = spec.find(' ', end + 1);
+            string value = spec.substr(end + 1, valueEnd == string::npos ? string::npos : valueEnd - end - 1);
+            char* parsedEnd = nullptr;
+            double seconds = strtod(value.c_str(), &parsedEnd);
+            if (value.empty() || *parsedEnd != '\0' || !(seconds > 0))
+            {
+                cerr << "Invalid " << option << " value: " << value << endl;
+                return false;
+            }
+            uint64_t milliseconds = static_cast<uint64_t>(seconds * 1000);
+            if (option == "--timeout")
+            {
+                job.TimeoutMs = milliseconds;
+            }
+            else // The tightest of several deadlines holds, a forwarded job carries its remaining time too
+            {
+                uint64_t deadline = TimerWheel::NowMs() + milliseconds;
+                job.Deadline = (job.Deadline == 0) ? deadline : min(job.Deadline, deadline);
+            }
+            end = valueEnd;
+        }
+        else if ((option == "--input" || option == "--stdin") && end != string::npos) // The file follows the command frame
+        {
+            size_t nameEnd = spec.find(' ', end + 1);
+            string name = spec.substr(end + 1, nameEnd == string::npos ? string::npos : nameEnd - end - 1);
+            if (!ReceiveInput(job, name, option == "--stdin"))
+            {
+                return false;
+            }
+            end = nameEnd;
+        }
+        else if (option == "--passfd") // The client's stdout follows the command frame
+        {
+            if (!SocketManager::IsUnixSocket(job.ClientSocket))
+            {
+                cerr << "--passfd needs a unix socket connection" << endl;
+                return false;
+            }
+            if (job.OutputFD >= 0 || !SocketController.ReceiveFD(job.ClientSocket, job.OutputFD))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            cerr << "Unknown job option: " << option << endl;
+            return false;
+        }
+        position = (end == string::npos) ? spec.length() : end + 1;
+    }
+
+    job.Command = spec.substr(position);
+    return !job.Command.empty();
+}
+
+string Server::GetStats()
+{
+    pthread_mutex_lock(&StatsMutex);
+    uint64_t transfers = CompressedTransfers;
+    uint64_t rawBytes = OutputBytesRaw;
+    uint64_t sentBytes = OutputBytesSent;
+    pthread_mutex_unlock(&StatsMutex);
+
+    ostringstream response;
+    response << "COMPRESSED TRANSFERS " << transfers << "\n";
+    response << "OUTPUT BYTES RAW " << rawBytes << ", SENT " << sentBytes << "\n";
+    response << "COMPRESSION RATIO " << fixed << setprecision(2)
+             << (sentBytes > 0 ? static_cast<double>(rawBytes) / sentBytes : 1.0) << "\n";
+    return response.str();
+}
+
+// Lists the queued jobs, caller must hold QueueMutex
+string Server::BuildSnapshot()
+{
+    string snapshot;
+    for (const auto& job : JobQueue)
+    {
+        snapshot += job.ID + ", " + job.Command + "\n";
+    }
+    return snapshot;
+}
+
+// Lists the running jobs and where they are placed, caller must hold QueueMutex
+string Server::BuildRunningList()
+{
+    string list;
+    for (const auto& running : RunningJobs)
+    {
+        list += running.first + ", " + running.second.Command + ", " + Topology.DescribePlacement(running.second.Cpus) + "\n";
+    }
+    return list;
+}
+
+// Streams job state changes to the client until it disconnects or the server stops
+void Server::WatchJobs(int clientSocket)
+{
+    pthread_mutex_lock(&QueueMutex);
+    if (!IsRunning)
+    {
+        pthread_mutex_unlock(&QueueMutex);
+        return;
+    }
+    // Events are published under QueueMutex, so nothing can slip between the snapshot and the subscription
+    Subscriber* subscriber = Events.Subscribe(clientSocket);
+    string snapshot = "SNAPSHOT\n" + BuildSnapshot();
+    pthread_mutex_unlock(&QueueMutex);
+
+    bool connected = SocketController.SendMessage(clientSocket, snapshot);
+    vector<string> events;
+    bool resync = false;
+    while (connected && Events.WaitForEvents(subscriber, events, resync, WatchPollIntervalMs))
+    {
+        if (resync)
+        {
+            pthread_mutex_lock(&QueueMutex);
+            Events.Resync(subscriber);
+            snapshot = "RESYNC\n" + BuildSnapshot();
+            pthread_mutex_unlock(&QueueMutex);
+            connected = SocketController.SendMessage(clientSocket, snapshot);
+        }
+        else if (!events.empty())
+        {
+            string batch;
+            for (const auto& event : events)
+            {
+                batch += event + "\n";
+            }
+            connected = SocketController.SendMessage(clientSocket, batch);
+        }
+        else // Idle, make sure the watcher is still there
+        {
+            char probe;
+            connected = recv(clientSocket, &probe, sizeof(probe), MSG_PEEK | MSG_DONTWAIT) != 0;
+        }
+    }
+
+    Events.Unsubscribe(subscriber);
+}
+
+string Server::NextJobID()
+{
+    string jobID = "job_" + to_string(JobCounter++);
+    return Options.ShardName.empty() ? jobID : Options.ShardName + "." + jobID;
+}
+
+string Server::GetLoad()
+{
+    pthread_mutex_lock(&QueueMutex);
+    string load = "LOAD " + to_string(JobQueue.size() + BlockedJobs.size()) + " " + to_string(ActiveWorkers) + " " +
+                  to_string(ConcurrencyLevel) + " " + to_string(BufferSize) + "\n";
+    pthread_mutex_unlock(&QueueMutex);
+    return load;
+}
+
+// Hands a job our full queue cannot take to the first peer with room, relaying the peer's responses
+bool Server::ForwardJob(const Job& job, const string& spec)
+{
+    // The peer would count the spec's relative deadline from its own arrival, tell it what is left
+    string options = "--forwarded ";
+    if (job.Deadline != 0)
+    {
+        uint64_t now = TimerWheel::NowMs();
+        if (now >= job.Deadline)
+        {
+            return false; // Missed already, the expiry timer answers the client
+        }
+        ostringstream remaining;
+        remaining << fixed << setprecision(3) << (job.Deadline - now) / 1000.0;
+        options += "--deadline " + remaining.str() + " ";
+    }
+
+    for (const auto& peer : Options.Peers)
+    {
+        string host;
+        string port;
+        Transport::SplitHostPort(peer, "", host, port);
+
+        SocketManager peerConnection;
+        string load;
+        if (!peerConnection.ResolveAndConnect(host, port) ||
+            !peerConnection.SendMessage(peerConnection.GetClientSocketFD(), "load") ||
+            !peerConnection.ReceiveMessage(peerConnection.GetClientSocketFD(), load))
+        {
+            continue;
+        }
+
+        istringstream loadStream(load);
+        string tag;
+        int queued = 0;
+        int running = 0;
+        int concurrency = 0;
+        int bufferSize = 0;
+        loadStream >> tag >> queued >> running >> concurrency >> bufferSize;
+        if (queued >= bufferSize)
+        {
+            continue;
+        }
+
+        if (!peerConnection.ResolveAndConnect(host, port) ||
+            !peerConnection.SendMessage(peerConnection.GetClientSocketFD(), "issueJob " + options + spec))
+        {
+            continue;
+        }
+        cout << "Forwarded job to " << peer << endl;
+        peerConnection.RelayStream(peerConnection.GetClientSocketFD(), job.ClientSocket);
+        return true;
+    }
+    return false;
+}
+
+// Jobs with a time limit need their own process group to be killed on their own
+// Only jobs the client marked --short, one long job would hold up the rest of its batch
+bool Server::IsBatchable(const Job& job)
+{
+    return job.Short && job.OutputFD < 0 && job.TimeoutMs == 0 && job.Deadline == 0 && job.InputDir.empty();
+}
+
+// Tops up a batch with the batchable jobs at the head of the queue, waiting up to the batch
+// window for more to arrive. Caller holds QueueMutex.
+void Server::CollectBatch(vector<Job>& batch)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += Options.BatchWindowMs * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    while ((int)batch.size() < Options.BatchSize && IsRunning)
+    {
+        if (JobQueue.empty())
+        {
+            if (pthread_cond_timedwait(&JobAvailable, &QueueMutex, &deadline) == ETIMEDOUT)
+            {
+                break;
+            }
+            continue;
+        }
+        if (!IsBatchable(JobQueue.front()))
+        {
+            break;
+        }
+        batch.push_back(JobQueue.front());
+        JobQueue.pop_front();
+    }
+    if (!JobQueue.empty()) // The wakeups we took may have been meant for another idle worker
+    {
+        pthread_cond_signal(&JobAvailable);
+    }
+}
+
+string Server::ShellQuote(const string& text)
+{
+    string quoted = "'";
+    for (char c : text)
+    {
+        quoted += (c == '\'') ? string("'\\''") : string(1, c);
+    }
+    return quoted + "'";
+}
+
+// Registers the job under its unfinished parents, caller must hold QueueMutex.
+// Returns true if it has to wait, sets error if it can never run.
+bool Server::BlockOnParents(Job& job, string& error)
+{
+    BlockedJob blocked{ job, {} };
+    for (const auto& parent : job.After)
+    {
+        auto finished = FinishedJobs.find(parent);
+        if (finished != FinishedJobs.end())
+        {
+            if (!job.AfterAny && finished->second != 0)
+            {
+                error = "JOB " + job.ID + " DEPENDENCY " + parent + " FAILED\n";
+                return false;
+            }
+        }
+        else if (IsKnownJob(parent))
+        {
+            blocked.Waiting.insert(parent);
+        }
+        else
+        {
+            error = "JOB " + job.ID + " DEPENDENCY " + parent + " NOT FOUND\n";
+            return false;
+        }
+    }
+
+    if (blocked.Waiting.empty())
+    {
+        return false;
+    }
+    for (const auto& parent : blocked.Waiting)
+    {
+        Dependents[parent].push_back(job.ID);
+    }
+    BlockedJobs[job.ID] = blocked;
+    Events.Publish("BLOCKED " + job.ID + ", " + job.Command);
+    return true;
+}
+
+bool Server::IsKnownJob(const string& jobID)
+{
+    if (RunningJobs.count(jobID) || BlockedJobs.count(jobID))
+    {
+        return true;
+    }
+    for (const auto& job : JobQueue)
+    {
+        if (job.ID == jobID)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Records a terminal status and releases or fails the jobs waiting on it, caller must hold QueueMutex.
+// A failure cascades down the dependency chain through a worklist rather than recursion.
+void Server::CompleteJob(const string& jobID, int status)
+{
+    deque<pair<string, int>> completed = { { jobID, status } };
+    while (!completed.empty())
+    {
+        string parent = completed.front().first;
+        int parentStatus = completed.front().second;
+        completed.pop_front();
+
+        FinishedJobs[parent] = parentStatus;
+        FinishedOrder.push_back(parent);
+        if (FinishedOrder.size() > FinishedJobsKept)
+        {
+            FinishedJobs.erase(FinishedOrder.front());
+            FinishedOrder.pop_front();
+        }
+
+        auto dependents = Dependents.find(parent);
+        if (dependents == Dependents.end())
+        {
+            continue;
+        }
+        vector<string> children = dependents->second;
+        Dependents.erase(dependents);
+
+        for (const auto& child : children)
+        {
+            auto blocked = BlockedJobs.find(child);
+            if (blocked == BlockedJobs.end())
+            {
+                continue; // Already failed through another parent or removed
+            }
+
+            Job& entry = blocked->second.Entry;
+            if (!entry.AfterAny && parentStatus != 0)
+            {
+                NotifyFailure(entry, "JOB " + child + " DEPENDENCY " + parent + " FAILED\n");
+                Events.Publish("FAILED " + child + ", dependency " + parent);
+                BlockedJobs.erase(blocked);
+                pthread_cond_signal(&SpaceAvailable);
+                completed.push_back({ child, -1 });
+                continue;
+            }
+
+            blocked->second.Waiting.erase(parent);
+            if (blocked->second.Waiting.empty()) // Its parents already waited their turn, run it next
+            {
+                // Moves from BlockedJobs to the queue, the buffer occupancy stays the same
+                JobQueue.push_front(entry);
+                Events.Publish("RELEASED " + child);
+                BlockedJobs.erase(blocked);
+                pthread_cond_signal(&JobAvailable);
+            }
+        }
+    }
+}
+
+// Lists the jobs held back by their dependencies, caller must hold QueueMutex
+string Server::BuildBlockedList()
+{
+    string list;
+    for (const auto& blocked : BlockedJobs)
+    {
+        string waiting;
+        for (const auto& parent : blocked.second.Waiting)
+        {
+            waiting += (waiting.empty() ? "" : ",") + parent;
+        }
+        list += blocked.first + ", " + blocked.second.Entry.Command + ", waiting on " + waiting + "\n";
+    }
+    return list;
+}
+
+int Server::ExitCode(int status)
+{
+    if (WIFEXITED(status))
+    {
+        return WEXITSTATUS(status);
+    }
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : -1;
+}
+
+// "on" and "off" switch tracing, anything else dumps the rings as Chrome trace JSON
+string Server::HandleTrace(const string& argument)
+{
+    string mode = argument;
+    mode.erase(0, mode.find_first_not_of(' '));
+    if (mode == "on" || mode == "off")
+    {
+        Tracer::SetEnabled(mode == "on");
+        return "TRACING " + string(mode == "on" ? "ENABLED" : "DISABLED") + "\n";
+    }
+    return Tracer::DumpChromeJson();
+}
+
+// Deadline jobs go ahead of best-effort ones in earliest deadline order, both classes stay FIFO
+// among equals. Caller holds QueueMutex.
+void Server::EnqueueJob(const Job& job)
+{
+    if (job.Deadline == 0)
+    {
+        JobQueue.push_back(job);
+        return;
+    }
+    auto position = find_if(JobQueue.begin(), JobQueue.end(), [&job](const Job& queued)
+    {
+        return queued.Deadline == 0 || queued.Deadline > job.Deadline;
+    });
+    JobQueue.insert(position, job);
+}
+
+// Deadline timer of a job that may still be queued or blocked, a started job is left alone
+void Server::ExpireJob(const string& jobID)
+{
+    pthread_mutex_lock(&QueueMutex);
+    auto queued = find_if(JobQueue.begin(), JobQueue.end(), [&jobID](const Job& job) { return job.ID == jobID; });
+    if (queued != JobQueue.end())
+    {
+        Job job = *queued;
+        JobQueue.erase(queued);
+        MissDeadline(job);
+    }
+    auto blocked = BlockedJobs.find(jobID);
+    if (blocked != BlockedJobs.end())
+    {
+        Job job = blocked->second.Entry;
+        BlockedJobs.erase(blocked);
+        MissDeadline(job);
+    }
+    pthread_mutex_unlock(&QueueMutex);
+}
+
+// Fails a job that can no longer start in time, caller holds QueueMutex. Also runs on the timer
+// thread, so the client is told by NoticeThread.
+void Server::MissDeadline(const Job& job)
+{
+    NotifyFailure(job, "JOB " + job.ID + " DEADLINE MISSED\n");
+    Events.Publish("MISSED " + job.ID);
+    pthread_cond_signal(&SpaceAvailable);
+    CompleteJob(job.ID, -1);
+}
+
+// Queues the final response of a job that will not run, its client may be slow to read
+void Server::NotifyFailure(const Job& job, const string& response)
+{
+    pthread_mutex_lock(&NoticeMutex);
+    FailureNotices.push_back({ job, response });
+    pthread_cond_signal(&NoticeAvailable);
+    pthread_mutex_unlock(&NoticeMutex);
+}
+
+// Sends failure responses and releases what the failed jobs held, until the server shuts down
+void* Server::NoticeThreadFunction(void* arg)
+{
+    Server* serverInstance = static_cast<Server*>(arg);
+    pthread_mutex_lock(&serverInstance->NoticeMutex);
+    while (true)
+    {
+        while (serverInstance->FailureNotices.empty() && !serverInstance->NoticesClosed)
+        {
+            pthread_cond_wait(&serverInstance->NoticeAvailable, &serverInstance->NoticeMutex);
+        }
+        if (serverInstance->FailureNotices.empty())
+        {
+            break;
+        }
+        pair<Job, string> notice = serverInstance->FailureNotices.front();
+        serverInstance->FailureNotices.pop_front();
+        pthread_mutex_unlock(&serverInstance->NoticeMutex);
+
+        const Job& job = notice.first;
+        if (job.ClientSocket >= 0)
+        {
+            serverInstance->SocketController.SendMessage(job.ClientSocket, notice.second);
+            close(job.ClientSocket);
+        }
+        if (job.OutputFD >= 0)
+        {
+            close(job.OutputFD);
+        }
+        DiscardInputs(job);
+        pthread_mutex_lock(&serverInstance->NoticeMutex);
+    }
+    pthread_mutex_unlock(&serverInstance->NoticeMutex);
+    return nullptr;
+}
+
+// The job's limit is its timeout or what is left until its deadline, whichever is shorter
+void Server::ArmKillTimer(pid_t pid, const Job& job)
+{
+    if (job.TimeoutMs == 0 && job.Deadline == 0)
+    {
+        return;
+    }
+    uint64_t limitMs = job.TimeoutMs;
+    if (job.Deadline != 0)
+    {
+        uint64_t now = TimerWheel::NowMs();
+        uint64_t remainingMs = (job.Deadline > now) ? job.Deadline - now : 0;
+        limitMs = (limitMs == 0) ? remainingMs : min(limitMs, remainingMs);
+    }
+
+    pthread_mutex_lock(&KillMutex);
+    uint64_t timerID = Timers.Schedule(limitMs, [this, pid]() { OnKillTimer(pid); });
+    KillTimers[pid] = KillTimer{ timerID, job.ID, false };
+    pthread_mutex_unlock(&KillMutex);
+}
+
+// Returns true if the job had to be signalled
+bool Server::DisarmKillTimer(pid_t pid)
+{
+    pthread_mutex_lock(&KillMutex);
+    bool signalled = false;
+    auto timer = KillTimers.find(pid);
+    if (timer != KillTimers.end())
+    {
+        Timers.Cancel(timer->second.TimerID);
+        signalled = timer->second.Signalled;
+        KillTimers.erase(timer);
+    }
+    pthread_mutex_unlock(&KillMutex);
+    return signalled;
+}
+
+// SIGTERM to the job's process group first, SIGKILL if it is still there after the grace period
+void Server::OnKillTimer(pid_t pid)
+{
+    pthread_mutex_lock(&KillMutex);
+    auto timer = KillTimers.find(pid);
+    if (timer == KillTimers.end()) // Finished in the meantime
+    {
+        pthread_mutex_unlock(&KillMutex);
+        return;
+    }
+    int signal = timer->second.Signalled ? SIGKILL : SIGTERM;
+    string jobID = timer->second.JobID;
+    kill(-pid, signal);
+    if (!timer->second.Signalled)
+    {
+        timer->second.Signalled = true;
+        timer->second.TimerID = Timers.Schedule(Options.KillGraceMs, [this, pid]() { OnKillTimer(pid); });
+    }
+    pthread_mutex_unlock(&KillMutex);
+    Events.Publish("TIMEOUT " + jobID + ", " + (signal == SIGKILL ? "SIGKILL" : "SIGTERM"));
+}
+
+// Drops the job if it is still waiting when its deadline passes
+void Server::ScheduleExpiry(const Job& job)
+{
+    if (job.Deadline == 0)
+    {
+        return;
+    }
+    string jobID = job.ID;
+    uint64_t now = TimerWheel::NowMs();
+    Timers.Schedule(job.Deadline > now ? job.Deadline - now : 0, [this, jobID]() { ExpireJob(jobID); });
+}
+
+// Starts the binary again with --takeover and hands it the listeners and every job that has not
+// started yet. Running jobs stay with us, the new server hears about them finishing. Not while
+// our own predecessor still runs jobs, their completions would have nobody to go to.
+string Server::HotRestart()
+{
+    pthread_mutex_lock(&QueueMutex);
+    bool busy = RestartPending || HandedOff || !IsRunning || !InheritedJobs.empty() || Options.Arguments.empty();
+    RestartPending = RestartPending || !busy;
+    pthread_mutex_unlock(&QueueMutex);
+    if (busy)
+    {
+        return "RESTART NOT POSSIBLE\n";
+    }
+
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == -1)
+    {
+        perror("socketpair");
+        pthread_mutex_lock(&QueueMutex);
+        RestartPending = false;
+        pthread_mutex_unlock(&QueueMutex);
+        return "RESTART FAILED\n";
+    }
+    vector<string> arguments = Options.Arguments;
+    arguments.push_back("--takeover");
+    arguments.push_back(to_string(sockets[1]));
+    vector<char*> argv;
+    for (auto& argument : arguments)
+    {
+        argv.push_back(&argument[0]);
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        fcntl(sockets[1], F_SETFD, 0); // The only descriptor the new server inherits
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    close(sockets[1]);
+    if (pid < 0)
+    {
+        perror("fork");
+    }
+
+    // Submissions only pause from here until the new server has adopted the state
+    string reply;
+    bool ready = pid > 0 && WaitForHandoff(sockets[0], reply) && reply == "READY";
+    bool adopted = false;
+    pthread_mutex_lock(&QueueMutex);
+    if (ready)
+    {
+        vector<int> fds;
+        adopted = SocketController.SendMessage(sockets[0], SerializeState(fds));
+        for (size_t i = 0; adopted && i < fds.size(); i++)
+        {
+            adopted = SocketController.SendFD(sockets[0], fds[i]);
+        }
+        adopted = adopted && WaitForHandoff(sockets[0], reply) && reply == "ADOPTED";
+    }
+    if (adopted)
+    {
+        for (auto& blocked : BlockedJobs)
+        {
+            JobQueue.push_back(blocked.second.Entry);
+        }
+        for (const auto& job : JobQueue) // The new server holds its own copies
+        {
+            close(job.ClientSocket);
+            if (job.OutputFD >= 0)
+            {
+                close(job.OutputFD);
+            }
+        }
+        JobQueue.clear();
+        BlockedJobs.clear();
+        Dependents.clear();
+        HandedOff = true;
+        HandoffFD = sockets[0];
+        Events.Publish("RESTARTED " + to_string(pid));
+        pthread_cond_broadcast(&SpaceAvailable);
+        if (ActiveWorkers == 0)
+        {
+            FinishDrain();
+        }
+    }
+    RestartPending = false;
+    pthread_mutex_unlock(&QueueMutex);
+
+    if (!adopted)
+    {
+        close(sockets[0]);
+        if (pid > 0)
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+        cerr << "Hot restart failed, keeping the current server" << endl;
+        return "RESTART FAILED\n";
+    }
+    cout << "Handed off to pid " << pid << endl;
+    return "SERVER RESTARTED, NEW PID " + to_string(pid) + "\n";
+}
+
+bool Server::WaitForHandoff(int channel, string& message)
+{
+    struct pollfd pollFD = { channel, POLLIN, 0 };
+    return poll(&pollFD, 1, HandoffTimeoutMs) == 1 && SocketController.ReceiveMessage(channel, message);
+}
+
+// Everything a new server needs to carry on, descriptors are sent after it in the order of fds.
+// Caller holds QueueMutex.
+string Server::SerializeState(vector<int>& fds)
+{
+    ostringstream state;
+    state << "STATE " << JobCounter << ' ' << ConcurrencyLevel << ' ' << SocketController.GetListenerCount() << '\n';
+    for (size_t i = 0; i < SocketController.GetListenerCount(); i++)
+    {
+        fds.push_back(SocketController.GetListenerFD(i));
+    }
+
+    state << "FINISHED " << FinishedOrder.size() << '\n';
+    for (const auto& jobID : FinishedOrder)
+    {
+        state << quoted(jobID) << ' ' << FinishedJobs[jobID] << '\n';
+    }
+    state << "QUEUED " << JobQueue.size() << '\n';
+    for (const auto& job : JobQueue)
+    {
+        WriteJob(state, job, fds);
+        state << '\n';
+    }
+    state << "BLOCKED " << BlockedJobs.size() << '\n';
+    for (const auto& blocked : BlockedJobs)
+    {
+        WriteJob(state, blocked.second.Entry, fds);
+        state << ' ' << blocked.second.Waiting.size();
+        for (const auto& parent : blocked.second.Waiting)
+        {
+            state << ' ' << quoted(parent);
+        }
+        state << '\n';
+    }
+    state << "RUNNING " << RunningJobs.size() << '\n';
+    for (const auto& running : RunningJobs)
+    {
+        state << quoted(running.first) << ' ' << quoted(running.second.Command) << ' ' << running.second.Cpus.size();
+        for (int cpu : running.second.Cpus)
+        {
+            state << ' ' << cpu;
+        }
+        state << '\n';
+    }
+    return state.str();
+}
+
+// Takes over from the server that exec'd us, see HotRestart
+bool Server::AdoptState()
+{
+    int channel = Options.TakeoverFD; // Already close-on-exec, see main
+    string blob;
+    if (!SocketController.SendMessage(channel, "READY") || !SocketController.ReceiveMessage(channel, blob))
+    {
+        return false;
+    }
+
+    istringstream state(blob);
+    string tag;
+    size_t listenerCount = 0;
+    int jobCounter = 0;
+    pthread_mutex_lock(&QueueMutex);
+    state >> tag >> jobCounter >> ConcurrencyLevel >> listenerCount;
+    JobCounter = jobCounter;
+    size_t expectedListeners = Options.Acceptors + (Options.UnixPath.empty() ? 0 : 1);
+    bool adopted = tag == "STATE" && listenerCount == expectedListeners;
+    for (size_t i = 0; adopted && i < listenerCount; i++)
+    {
+        int serverFD;
+        adopted = SocketController.ReceiveFD(channel, serverFD);
+        if (adopted)
+        {
+            bool isTcp = i < (size_t)Options.Acceptors;
+            SocketController.AdoptListener(serverFD, unique_ptr<Transport>(isTcp
+                ? static_cast<Transport*>(new TcpTransport("", to_string(Port), Options.Acceptors > 1))
+                : new UnixTransport(Options.UnixPath)));
+        }
+    }
+
+    size_t count = 0;
+    state >> tag >> count;
+    for (size_t i = 0; adopted && i < count; i++)
+    {
+        string jobID;
+        int status;
+        state >> quoted(jobID) >> status;
+        FinishedJobs[jobID] = status;
+        FinishedOrder.push_back(jobID);
+    }
+    state >> tag >> count;
+    for (size_t i = 0; adopted && i < count; i++)
+    {
+        Job job;
+        adopted = ReadJob(state, channel, job);
+        JobQueue.push_back(job);
+        ScheduleExpiry(job);
+    }
+    state >> tag >> count;
+    for (size_t i = 0; adopted && i < count; i++)
+    {
+        BlockedJob blocked;
+        size_t waitingCount = 0;
+        adopted = ReadJob(state, channel, blocked.Entry) && (state >> waitingCount);
+        for (size_t j = 0; adopted && j < waitingCount; j++)
+        {
+            string parent;
+            state >> quoted(parent);
+            blocked.Waiting.insert(parent);
+            Dependents[parent].push_back(blocked.Entry.ID);
+        }
+        BlockedJobs[blocked.Entry.ID] = blocked;
+        ScheduleExpiry(blocked.Entry);
+    }
+    state >> tag >> count;
+    for (size_t i = 0; adopted && i < count; i++)
+    {
+        string jobID;
+        RunningJob running;
+        size_t cpuCount = 0;
+        state >> quoted(jobID) >> quoted(running.Command) >> cpuCount;
+        running.Cpus.resize(cpuCount);
+        for (auto& cpu : running.Cpus)
+        {
+            state >> cpu;
+        }
+        Topology.Reserve(running.Cpus);
+        RunningJobs[jobID] = running;
+        InheritedJobs.insert(jobID);
+        ActiveWorkers++; // Still holds a slot until the old server reports it finished
+    }
+
+    adopted = adopted && !state.fail() && SocketController.SendMessage(channel, "ADOPTED");
+    if (adopted)
+    {
+        cout << "Took over " << JobQueue.size() << " queued, " << BlockedJobs.size() << " blocked and "
+             << InheritedJobs.size() << " running jobs" << endl;
+        pthread_cond_broadcast(&JobAvailable);
+    }
+    pthread_mutex_unlock(&QueueMutex);
+    return adopted;
+}
+
+// One line per job, its client socket and output descriptor (if any) are added to fds
+void Server::WriteJob(ostream& out, const Job& job, vector<int>& fds)
+{
+    out << quoted(job.ID) << ' ' << quoted(job.Command) << ' ' << (job.ClientSocket >= 0) << ' ' << job.Compress << ' '
+        << (job.OutputFD >= 0) << ' ' << job.Forwarded << ' ' << job.AfterAny << ' ' << job.TimeoutMs << ' '
+        << job.Deadline << ' ' << quoted(job.InputDir) << ' ' << quoted(job.StdinFile) << ' ' << job.Short << ' ' << job.After.size();
+    for (const auto& parent : job.After)
+    {
+        out << ' ' << quoted(parent);
+    }
+    if (job.ClientSocket >= 0)
+    {
+        fds.push_back(job.ClientSocket);
+    }
+    if (job.OutputFD >= 0)
+    {
+        fds.push_back(job.OutputFD);
+    }
+}
+
+bool Server::ReadJob(istream& in, int channel, Job& job)
+{
+    bool hasClient = false;
+    bool hasOutput = false;
+    size_t parentCount = 0;
+    in >> quoted(job.ID) >> quoted(job.Command) >> hasClient >> job.Compress >> hasOutput >> job.Forwarded
+       >> job.AfterAny >> job.TimeoutMs >> job.Deadline >> quoted(job.InputDir) >> quoted(job.StdinFile) >> job.Short >> parentCount;
+    job.After.resize(in ? parentCount : 0);
+    for (auto& parent : job.After)
+    {
+        in >> quoted(parent);
+    }
+    if (!in)
+    {
+        return false;
+    }
+    return (!hasClient || SocketController.ReceiveFD(channel, job.ClientSocket)) &&
+           (!hasOutput || SocketController.ReceiveFD(channel, job.OutputFD));
+}
+
+bool Server::SendHandoff(const string& message, const vector<int>& fds)
+{
+    pthread_mutex_lock(&HandoffMutex);
+    bool sent = SocketController.SendMessage(HandoffFD, message);
+    for (size_t i = 0; sent && i < fds.size(); i++)
+    {
+        sent = SocketController.SendFD(HandoffFD, fds[i]);
+    }
+    pthread_mutex_unlock(&HandoffMutex);
+    return sent;
+}
+
+// A job that reached us after the hot restart, the new server gives it its ID
+void Server::HandOffJob(const Job& job, const string& spec)
+{
+    ostringstream message;
+    vector<int> fds;
+    message << "JOB ";
+    WriteJob(message, job, fds);
+    message << ' ' << quoted(spec);
+    if (!SendHandoff(message.str(), fds) && job.ClientSocket >= 0)
+    {
+        SocketController.SendMessage(job.ClientSocket, "SERVER TERMINATED BEFORE EXECUTION");
+    }
+    close(job.ClientSocket);
+    if (job.OutputFD >= 0)
+    {
+        close(job.OutputFD);
+    }
+}
+
+// A connection the old acceptors took after the hot restart, nothing has been read from it yet
+void Server::HandOffClient(int clientSocket)
+{
+    SendHandoff("CLIENT", { clientSocket });
+    close(clientSocket);
+}
+
+// A job the old server still ran has finished, caller holds QueueMutex
+void Server::FinishInherited(const string& jobID, int status)
+{
+    if (InheritedJobs.erase(jobID) == 0)
+    {
+        return;
+    }
+    Topology.Release(RunningJobs[jobID].Cpus);
+    RunningJobs.erase(jobID);
+    ActiveWorkers--;
+    Events.Publish("FINISHED " + jobID + ", exit " + to_string(status));
+    CompleteJob(jobID, status);
+    pthread_cond_signal(&JobAvailable);
+}
+
+// Stops a handed off server once its last job is done. The listeners are left open, they are shared
+// with the new server. Caller holds QueueMutex.
+void Server::FinishDrain()
+{
+    IsRunning = false;
+    pthread_cond_broadcast(&JobAvailable);
+    pthread_cond_broadcast(&SpaceAvailable);
+    Events.Publish("SERVER RESTARTED");
+    Events.Close();
+    cout << "SERVER HANDED OFF" << endl;
+}
+
+// Serves the old server after a hot restart until it has drained
+void* Server::HandoffThreadFunction(void* arg)
+{
+    Server* serverInstance = static_cast<Server*>(arg);
+    int channel = serverInstance->Options.TakeoverFD;
+    string message;
+    while (serverInstance->SocketController.ReceiveMessage(channel, message))
+    {
+        istringstream request(message);
+        string kind;
+        request >> kind;
+        if (kind == "CLIENT")
+        {
+            int clientSocket;
+            if (!serverInstance->SocketController.ReceiveFD(channel, clientSocket))
+            {
+                break;
+            }
+            ClientHandlerArgs* clientArgs = new ClientHandlerArgs{ serverInstance, clientSocket };
+            pthread_t clientThread;
+            pthread_create(&clientThread, nullptr, &Server::HandleClient, clientArgs);
+            pthread_detach(clientThread);
+        }
+        else if (kind == "JOB")
+        {
+            AdmitArgs* admitArgs = new AdmitArgs{ serverInstance, Job(), "" };
+            if (!serverInstance->ReadJob(request, channel, admitArgs->Entry))
+            {
+                delete admitArgs;
+                break;
+            }
+            request >> quoted(admitArgs->Spec); // Missing from older servers, the job is then not forwarded
+            admitArgs->Entry.ID = serverInstance->NextJobID();
+            pthread_t admitThread;
+            pthread_create(&admitThread, nullptr, &Server::AdmitThreadFunction, admitArgs);
+            pthread_detach(admitThread);
+        }
+        else if (kind == "FINISHED")
+        {
+            string jobID;
+            int status = -1;
+            request >> jobID >> status;
+            pthread_mutex_lock(&serverInstance->QueueMutex);
+            serverInstance->FinishInherited(jobID, status);
+            pthread_mutex_unlock(&serverInstance->QueueMutex);
+        }
+    }
+
+    // The old server is gone, whatever it still ran will not be reported
+    pthread_mutex_lock(&serverInstance->QueueMutex);
+    set<string> lost = serverInstance->InheritedJobs;
+    for (const auto& jobID : lost)
+    {
+        serverInstance->FinishInherited(jobID, -1);
+    }
+    pthread_mutex_unlock(&serverInstance->QueueMutex);
+    return nullptr;
+}
+
+void* Server::AdmitThreadFunction(void* arg)
+{
+    AdmitArgs* args = static_cast<AdmitArgs*>(arg);
+    Server* serverInstance = args->ServerInstance;
+    Job job = args->Entry;
+    string spec = args->Spec;
+    delete args;
+    serverInstance->AdmitJob(job, spec);
+    return nullptr;
+}
+
+// Lands one uploaded file in the job's scratch directory, which is created on the first one
+bool Server::ReceiveInput(Job& job, const string& name, bool isStdin)
+{
+    if (name.empty() || name == "." || name == ".." || name.find('/') != string::npos || (isStdin && !job.StdinFile.empty()))
+    {
+        cerr << "Invalid input file name: " << name << endl;
+        return false;
+    }
+    if (job.InputDir.empty())
+    {
+        char cwd[PATH_MAX];
+        string directory = string(getcwd(cwd, sizeof(cwd)) ? cwd : ".") + "/" + to_string(getpid()) + "." + job.ID + ".input";
+        if (mkdir(directory.c_str(), 0700) == -1)
+        {
+            perror("Failed to create input directory");
+            return false;
+        }
+        job.InputDir = directory;
+    }
+
+    string path = job.InputDir + "/" + name;
+    int inputFD = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (inputFD == -1)
+    {
+        perror("Failed to create input file");
+        return false;
+    }
+    bool received = SocketController.ReceiveFileData(job.ClientSocket, inputFD);
+    close(inputFD);
+    if (received && isStdin)
+    {
+        job.StdinFile = path;
+    }
+    return received;
+}
+
+// nftw callback, entries arrive children first so directories are already empty
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+    if (remove(path) == -1)
+    {
+        perror(path);
+    }
+    return 0; // Keep going, whatever is left is reported when the directory itself fails
+}
+
+// Removes the job's scratch directory with everything in it, the job may have added files and
+// subdirectories of its own
+void Server::DiscardInputs(const Job& job)
+{
+    if (job.InputDir.empty())
+    {
+        return;
+    }
+    if (nftw(job.InputDir.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS) == -1)
+    {
+        perror("Failed to remove input directory");
+    }
+}
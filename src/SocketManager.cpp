@@ -1,4 +1,5 @@
 #include "SocketManager.h"
+#include "Tracer.h"
 #include <cstring>
 #include <fcntl.h>
 #include <vector>
@@ -8,193 +9,170 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
-
-SocketManager::SocketManager() : ServerFD(-1), ClientFD(-1), AddrInfo(nullptr)
+#include <zlib.h>
+#include <poll.h>
+#include <cerrno>
+#include <sys/stat.h>
+
+// Compressed output is framed in chunks, each preceded by a 32-bit header whose top bit
+// marks a deflated payload and whose low bits hold the payload length
+static const size_t CompressionChunkSize = 16384;
+static const uint32_t CompressedChunkFlag = 0x80000000u;
+static const int IncompressibleChunkLimit = 4; // Stop trying after this many incompressible chunks in a row
+// With io_uring a file goes out as a linked read, send, read, send... chain, this many chunks per submit
+static const unsigned UringChunkSize = 65536;
+static const unsigned UringBatchChunks = 8;
+
+#ifdef COUNT_SEND_SYSCALLS
+atomic<uint64_t> SocketManager::SendSyscalls(0);
+#define COUNT_SEND_SYSCALL() SendSyscalls++
+#else
+#define COUNT_SEND_SYSCALL()
+#endif
+
+SocketManager::SocketManager() : ClientFD(-1)
 {
 }
 
 SocketManager::~SocketManager()
 {
-    if (ServerFD != -1)
+    CloseServerSocket();
+    for (int serverFD : ServerFDs)
     {
-        close(ServerFD);
+        close(serverFD);
     }
     if (ClientFD != -1)
     {
         close(ClientFD);
     }
-    FreeResources();
 }
 
-void SocketManager::FreeResources()
+bool SocketManager::ResolveAndConnect(const string& hostname, const string& port)
 {
-    if (AddrInfo != nullptr)
-    {
-        freeaddrinfo(AddrInfo);
-        AddrInfo = nullptr;
-    }
+    CloseClientSocket();
+    ClientTransport = Transport::Create(hostname, port);
+    ClientFD = ClientTransport->Connect();
+    return ClientFD != -1;
 }
 
-bool SocketManager::ResolveAndConnect(const string& hostname, const string& port)
+// Every listener gets its own SO_REUSEPORT socket so the kernel spreads connections between acceptors
+bool SocketManager::SetupServer(const string& port, int listenerCount, int backlog)
 {
-    struct addrinfo hints;
-    int status;
-    char ipString[INET_ADDRSTRLEN];
-
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;        // Use IPv4
-    hints.ai_socktype = SOCK_STREAM;  // TCP stream sockets
-
-    FreeResources();
-    if ((status = getaddrinfo(hostname.c_str(), port.c_str(), &hints, &AddrInfo)) != 0)
+    for (int i = 0; i < listenerCount; i++)
     {
-        cerr << "getaddrinfo: " << gai_strerror(status) << endl;
-        return false;
-    }
-
-    for (struct addrinfo* p = AddrInfo; p != NULL; p = p->ai_next)
-    {
-        void* address;
-        string ipVersion;
-
-        if (p->ai_family == AF_INET)
-        {
-            struct sockaddr_in* ipv4 = (struct sockaddr_in*)p->ai_addr;
-            address = &(ipv4->sin_addr);
-            ipVersion = "IPv4";
-        }
-        else
-        {
-            continue; // Skip non-IPv4 addresses
-        }
-
-        inet_ntop(p->ai_family, address, ipString, sizeof(ipString));
-        cout << "  " << ipVersion << ": " << ipString << endl;
-
-        ClientFD = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-        if (ClientFD == -1)
-        {
-            perror("socket");
-            continue; // Try the next address in case of error
-        }
-
-        if (connect(ClientFD, p->ai_addr, p->ai_addrlen) == -1)
+        if (!AddListener(unique_ptr<Transport>(new TcpTransport("", port, listenerCount > 1)), backlog))
         {
-            close(ClientFD);
-            ClientFD = -1;
-            perror("connect");
-            continue; // Try the next address in case of error
+            return false;
         }
-
-        cout << "Successfully connected to " << hostname << " on port " << port << " (" << ipVersion << ")\n";
-        return true;
     }
-
-    cerr << "Failed to connect to any address.\n";
-    return false;
+    return true;
 }
 
-bool SocketManager::SetupServer(const string& port)
+bool SocketManager::SetupUnixServer(const string& path, int backlog)
 {
-    struct addrinfo hints;
-    int status;
-
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;      // For wildcard IP address
+    return AddListener(unique_ptr<Transport>(new UnixTransport(path)), backlog);
+}
 
-    FreeResources();
-    if ((status = getaddrinfo(NULL, port.c_str(), &hints, &AddrInfo)) != 0)
+bool SocketManager::AddListener(unique_ptr<Transport> transport, int backlog)
+{
+    int serverFD = transport->Listen(backlog);
+    if (serverFD == -1)
     {
-        cerr << "getaddrinfo: " << gai_strerror(status) << endl;
         return false;
     }
 
-    ServerFD = socket(AddrInfo->ai_family, AddrInfo->ai_socktype, AddrInfo->ai_protocol);
-    if (ServerFD == -1)
-    {
-        perror("socket");
-        return false;
-    }
+    cout << "Server is listening on " << transport->Describe() << "\n";
+    ServerFDs.push_back(serverFD);
+    Listeners.push_back(move(transport));
+    return true;
+}
 
-    int yes = 1;
-    if (setsockopt(ServerFD, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1)
-    {
-        perror("setsockopt");
-        close(ServerFD);
-        ServerFD = -1;
-        return false;
-    }
+size_t SocketManager::GetListenerCount() const
+{
+    return ServerFDs.size();
+}
 
-    if (bind(ServerFD, AddrInfo->ai_addr, AddrInfo->ai_addrlen) == -1)
-    {
-        close(ServerFD);
-        perror("bind");
-        ServerFD = -1;
-        return false;
-    }
+int SocketManager::GetListenerFD(size_t listener) const
+{
+    return ServerFDs[listener];
+}
 
-    if (listen(ServerFD, 10) == -1)
+void SocketManager::AdoptListener(int serverFD, unique_ptr<Transport> transport)
+{
+    transport->Adopt();
+    cout << "Server took over " << transport->Describe() << "\n";
+    ServerFDs.push_back(serverFD);
+    Listeners.push_back(move(transport));
+}
+
+// Closes our copies of listeners another process has taken over, without shutting them down
+void SocketManager::ReleaseListeners()
+{
+    for (int serverFD : ServerFDs)
     {
-        close(ServerFD);
-        perror("listen");
-        ServerFD = -1;
-        return false;
+        close(serverFD);
     }
-
-    cout << "Server is listening on port " << port << "\n";
-    return true;
+    ServerFDs.clear();
+    Listeners.clear();
 }
 
-int SocketManager::AcceptConnection()
+// Returns -1 on errors and periodically so the caller can check for shutdown
+int SocketManager::AcceptConnection(size_t listener)
 {
+    struct pollfd pollFD = { ServerFDs[listener], POLLIN, 0 };
+    if (poll(&pollFD, 1, 500) <= 0 || !(pollFD.revents & POLLIN))
+    {
+        return -1;
+    }
+
     struct sockaddr_storage theirAddr;
     socklen_t addrSize = sizeof(theirAddr);
-    int newFD = accept(ServerFD, (struct sockaddr*)&theirAddr, &addrSize);
-    if (newFD == -1 && ServerFD != -1)
+    // Client sockets stay blocking, the request handlers use plain blocking send/recv loops
+    TraceScope trace("Accept");
+    int newFD = accept4(ServerFDs[listener], (struct sockaddr*)&theirAddr, &addrSize, SOCK_CLOEXEC);
+    if (newFD == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINVAL && errno != ECONNABORTED)
     {
         perror("accept");
-        return -1;
     }
     return newFD;
 }
 
+// Length prefix and payload go out as one sendmsg, a short send is finished with plain sends.
+// Always blocking: one syscall per message is already the floor, a ring round trip only adds to it.
 bool SocketManager::SendMessage(int socketFD, const string& message)
 {
-    uint32_t messageLength = message.length();
-    uint32_t netMessageLength = htonl(messageLength); // Convert to network byte order
-
-    size_t totalSent = 0;
-    const char* lengthPtr = reinterpret_cast<const char*>(&netMessageLength);
-    while (totalSent < sizeof(netMessageLength)) // Send the length of the data
+    TraceScope trace("SendMessage");
+    uint32_t netMessageLength = htonl(message.length()); // Convert to network byte order
+    struct iovec parts[2] = { { &netMessageLength, sizeof(netMessageLength) }, { const_cast<char*>(message.data()), message.length() } };
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = parts;
+    header.msg_iovlen = 2;
+
+    ssize_t sent = sendmsg(socketFD, &header, MSG_NOSIGNAL);
+    COUNT_SEND_SYSCALL();
+    if (sent == -1)
     {
-        ssize_t sent = send(socketFD, lengthPtr + totalSent, sizeof(netMessageLength) - totalSent, 0);
-        if (sent == -1)
-        {
-            perror("send length");
-            return false;
-        }
-        totalSent += sent;
+        perror("send message");
+        return false;
     }
-    
-    totalSent = 0;
-    const char* messagePtr = message.c_str();
-    while (totalSent < messageLength) // Send the actual data
+
+    size_t remaining = sent;
+    for (const auto& part : parts)
     {
-        ssize_t sent = send(socketFD, messagePtr + totalSent, messageLength - totalSent, 0);
-        if (sent == -1) {
-            perror("send message");
+        size_t skip = min(remaining, part.iov_len);
+        remaining -= skip;
+        if (!SendAll(socketFD, static_cast<const char*>(part.iov_base) + skip, part.iov_len - skip))
+        {
             return false;
         }
-        totalSent += sent;
     }
-
     return true;
 }
 
 bool SocketManager::ReceiveMessage(int socketFD, string& message)
 {
+    TraceScope trace("ReceiveMessage");
     uint32_t netMessageLength;
     size_t totalReceived = 0;
     char* lengthPtr = reinterpret_cast<char*>(&netMessageLength);
@@ -238,57 +216,38 @@ bool SocketManager::ReceiveMessage(int socketFD, string& message)
 
 bool SocketManager::SendFileData(int socketFD, const string& fileName)
 {
-    ifstream file(fileName, ios::binary | ios::ate);
-    if (!file)
+    TraceScope trace("SendFileData");
+    int fileFD = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat fileStatus;
+    if (fileFD == -1 || fstat(fileFD, &fileStatus) == -1)
     {
         cerr << "Error opening file: " << fileName << endl;
+        if (fileFD != -1)
+        {
+            close(fileFD);
+        }
         return false;
     }
 
-    uint64_t fileSize = file.tellg();
-    file.seekg(0, ios::beg);
-
-    uint64_t netFileSize = Htonll(fileSize); // Convert to network byte order
-    size_t totalSent = 0;
-    const char* sizePtr = reinterpret_cast<const char*>(&netFileSize);
-
-    while (totalSent < sizeof(netFileSize)) // Send the length of the data
+    IoUring* ring = IoUring::ForThread();
+    bool sent;
+    if (ring != nullptr)
     {
-        ssize_t sent = send(socketFD, sizePtr + totalSent, sizeof(netFileSize) - totalSent, 0);
-        if (sent == -1)
-        {
-            perror("send length");
-            return false;
-        }
-        totalSent += sent;
+        sent = SendFileDataUring(ring, socketFD, fileFD, fileStatus.st_size);
     }
-
-    char buffer[4096];
-    while (!file.eof())
+    else
     {
-        file.read(buffer, sizeof(buffer));
-        streamsize bytesRead = file.gcount();
-        totalSent = 0;
-        const char* bufferPtr = buffer;
-
-        while ((int)totalSent < bytesRead) // Send the actual data
-        {
-            ssize_t sent = send(socketFD, bufferPtr + totalSent, bytesRead - totalSent, 0);
-            if (sent == -1)
-            {
-                perror("send message");
-                return false;
-            }
-            totalSent += sent;
-        }
+        uint64_t netFileSize = Htonll(fileStatus.st_size); // Convert to network byte order
+        sent = SendAll(socketFD, reinterpret_cast<const char*>(&netFileSize), sizeof(netFileSize)) &&
+               SendFileRange(socketFD, fileFD, 0, fileStatus.st_size);
     }
-
-    file.close();
-    return true;
+    close(fileFD);
+    return sent;
 }
 
 bool SocketManager::ReceiveFileData(int socketFD)
 {
+    TraceScope trace("ReceiveFileData");
     uint64_t netFileSize;
     size_t totalReceived = 0;
     char* sizePtr = reinterpret_cast<char*>(&netFileSize);
@@ -324,6 +283,368 @@ bool SocketManager::ReceiveFileData(int socketFD)
     return true;
 }
 
+// Same as ReceiveFileData, but lands the data in a descriptor instead of stdout
+bool SocketManager::ReceiveFileData(int socketFD, int outputFD)
+{
+    TraceScope trace("ReceiveFileData");
+    uint64_t netFileSize;
+    if (!ReceiveAll(socketFD, reinterpret_cast<char*>(&netFileSize), sizeof(netFileSize)))
+    {
+        return false;
+    }
+
+    char buffer[4096];
+    uint64_t remaining = Ntohll(netFileSize);
+    while (remaining > 0)
+    {
+        size_t toReceive = min(sizeof(buffer), static_cast<size_t>(remaining));
+        if (!ReceiveAll(socketFD, buffer, toReceive))
+        {
+            return false;
+        }
+
+        size_t written = 0;
+        while (written < toReceive)
+        {
+            ssize_t result = write(outputFD, buffer + written, toReceive - written);
+            if (result == -1)
+            {
+                perror("write");
+                return false;
+            }
+            written += result;
+        }
+        remaining -= toReceive;
+    }
+
+    return true;
+}
+
+bool SocketManager::SendCompressedFileData(int socketFD, const string& fileName, uint64_t& rawBytes, uint64_t& sentBytes)
+{
+    TraceScope trace("SendCompressedFileData");
+    ifstream file(fileName, ios::binary | ios::ate);
+    if (!file)
+    {
+        cerr << "Error opening file: " << fileName << endl;
+        return false;
+    }
+
+    uint64_t fileSize = file.tellg();
+    file.seekg(0, ios::beg);
+    rawBytes = fileSize;
+    sentBytes = 0;
+
+    uint64_t netFileSize = Htonll(fileSize);
+    if (!SendAll(socketFD, reinterpret_cast<const char*>(&netFileSize), sizeof(netFileSize)))
+    {
+        return false;
+    }
+    sentBytes += sizeof(netFileSize);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit(&stream, Z_BEST_SPEED) != Z_OK)
+    {
+        cerr << "deflateInit failed" << endl;
+        return false;
+    }
+
+    vector<char> input(CompressionChunkSize);
+    vector<char> output(deflateBound(&stream, CompressionChunkSize) + 16);
+    int incompressibleRun = 0;
+    bool success = true;
+
+    while (success && !file.eof())
+    {
+        file.read(input.data(), input.size());
+        streamsize bytesRead = file.gcount();
+        if (bytesRead <= 0)
+        {
+            break;
+        }
+
+        size_t compressedSize = 0;
+        bool compressed = false;
+        if (incompressibleRun < IncompressibleChunkLimit)
+        {
+            stream.next_in = reinterpret_cast<Bytef*>(input.data());
+            stream.avail_in = bytesRead;
+            stream.next_out = reinterpret_cast<Bytef*>(output.data());
+            stream.avail_out = output.size();
+            int status = deflate(&stream, Z_SYNC_FLUSH);
+            compressedSize = output.size() - stream.avail_out;
+            // Only ship the deflated chunk if it actually saves bytes
+            compressed = (status == Z_OK && stream.avail_in == 0 && stream.avail_out > 0 && compressedSize < static_cast<size_t>(bytesRead));
+            if (compressed)
+            {
+                incompressibleRun = 0;
+            }
+            else
+            {
+                incompressibleRun++;
+                deflateReset(&stream); // The receiver resets too when it sees a raw chunk
+            }
+        }
+
+        const char* payload = compressed ? output.data() : input.data();
+        uint32_t payloadLength = compressed ? compressedSize : bytesRead;
+        uint32_t netHeader = htonl(payloadLength | (compressed ? CompressedChunkFlag : 0));
+        success = SendAll(socketFD, reinterpret_cast<const char*>(&netHeader), sizeof(netHeader)) &&
+                  SendAll(socketFD, payload, payloadLength);
+        sentBytes += sizeof(netHeader) + payloadLength;
+    }
+
+    deflateEnd(&stream);
+    file.close();
+    return success;
+}
+
+bool SocketManager::ReceiveCompressedFileData(int socketFD)
+{
+    TraceScope trace("ReceiveCompressedFileData");
+    uint64_t netFileSize;
+    if (!ReceiveAll(socketFD, reinterpret_cast<char*>(&netFileSize), sizeof(netFileSize)))
+    {
+        return false;
+    }
+    uint64_t remaining = Ntohll(netFileSize);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK)
+    {
+        cerr << "inflateInit failed" << endl;
+        return false;
+    }
+
+    vector<char> payload(CompressionChunkSize);
+    vector<char> output(CompressionChunkSize);
+    bool success = true;
+
+    while (success && remaining > 0)
+    {
+        uint32_t netHeader;
+        if (!ReceiveAll(socketFD, reinterpret_cast<char*>(&netHeader), sizeof(netHeader)))
+        {
+            success = false;
+            break;
+        }
+        uint32_t header = ntohl(netHeader);
+        uint32_t payloadLength = header & ~CompressedChunkFlag;
+        if (payloadLength > payload.size() || !ReceiveAll(socketFD, payload.data(), payloadLength))
+        {
+            cerr << "Invalid compressed chunk" << endl;
+            success = false;
+            break;
+        }
+
+        if (!(header & CompressedChunkFlag))
+        {
+            cout.write(payload.data(), payloadLength);
+            remaining -= min(remaining, static_cast<uint64_t>(payloadLength));
+            inflateReset(&stream);
+            continue;
+        }
+
+        stream.next_in = reinterpret_cast<Bytef*>(payload.data());
+        stream.avail_in = payloadLength;
+        do // A chunk never inflates beyond CompressionChunkSize, but drain defensively
+        {
+            stream.next_out = reinterpret_cast<Bytef*>(output.data());
+            stream.avail_out = output.size();
+            int status = inflate(&stream, Z_SYNC_FLUSH);
+            if (status != Z_OK && status != Z_BUF_ERROR)
+            {
+                cerr << "inflate failed" << endl;
+                success = false;
+                break;
+            }
+            size_t produced = output.size() - stream.avail_out;
+            cout.write(output.data(), produced);
+            remaining -= min(remaining, static_cast<uint64_t>(produced));
+        } while (stream.avail_out == 0);
+    }
+
+    inflateEnd(&stream);
+    return success;
+}
+
+// Copies everything the source sends until it closes the connection, framing is left untouched
+bool SocketManager::RelayStream(int sourceFD, int destinationFD)
+{
+    char buffer[4096];
+    while (true)
+    {
+        ssize_t received = recv(sourceFD, buffer, sizeof(buffer), 0);
+        if (received == -1)
+        {
+            perror("recv relay");
+            return false;
+        }
+        else if (received == 0)
+        {
+            return true;
+        }
+        if (!SendAll(destinationFD, buffer, received))
+        {
+            return false;
+        }
+    }
+}
+
+bool SocketManager::SendAll(int socketFD, const char* data, size_t length)
+{
+    size_t totalSent = 0;
+    while (totalSent < length)
+    {
+        ssize_t sent = send(socketFD, data + totalSent, length - totalSent, MSG_NOSIGNAL);
+        COUNT_SEND_SYSCALL();
+        if (sent == -1)
+        {
+            perror("send");
+            return false;
+        }
+        totalSent += sent;
+    }
+    return true;
+}
+
+bool SocketManager::ReceiveAll(int socketFD, char* data, size_t length)
+{
+    size_t totalReceived = 0;
+    while (totalReceived < length)
+    {
+        ssize_t received = recv(socketFD, data + totalReceived, length - totalReceived, 0);
+        if (received == -1)
+        {
+            perror("recv");
+            return false;
+        }
+        else if (received == 0) // Connection closed
+        {
+            return false;
+        }
+        totalReceived += received;
+    }
+    return true;
+}
+
+// Blocking file send, also finishes the part of a file an io_uring chain did not get out
+bool SocketManager::SendFileRange(int socketFD, int fileFD, uint64_t offset, uint64_t end)
+{
+    char buffer[UringChunkSize];
+    while (offset < end)
+    {
+        ssize_t bytesRead = pread(fileFD, buffer, min(sizeof(buffer), static_cast<size_t>(end - offset)), offset);
+        COUNT_SEND_SYSCALL();
+        if (bytesRead <= 0)
+        {
+            cerr << "File ended before its announced size" << endl;
+            return false;
+        }
+        if (!SendAll(socketFD, buffer, bytesRead))
+        {
+            return false;
+        }
+        offset += bytesRead;
+    }
+    return true;
+}
+
+// Sends the size header and the file as linked read/send pairs, up to UringBatchChunks per
+// io_uring_enter. A failed or short operation breaks the chain and the rest goes out blocking.
+bool SocketManager::SendFileDataUring(IoUring* ring, int socketFD, int fileFD, uint64_t fileSize)
+{
+    ring->Buffers.resize(UringChunkSize * UringBatchChunks);
+    uint64_t netFileSize = Htonll(fileSize);
+    uint64_t streamSize = sizeof(netFileSize) + fileSize;
+    uint64_t streamSent = 0; // Header and file bytes the kernel confirmed
+    uint64_t nextOffset = 0; // File bytes already queued
+    bool headerQueued = false;
+
+    while (streamSent < streamSize)
+    {
+        vector<unsigned> lengths; // Expected result of each queued operation
+        vector<bool> isSend;
+        if (!headerQueued)
+        {
+            ring->PrepareSend(socketFD, reinterpret_cast<const char*>(&netFileSize), sizeof(netFileSize), lengths.size(), fileSize > 0);
+            lengths.push_back(sizeof(netFileSize));
+            isSend.push_back(true);
+            headerQueued = true;
+        }
+        for (unsigned chunk = 0; chunk < UringBatchChunks && nextOffset < fileSize; chunk++)
+        {
+            unsigned length = min(static_cast<uint64_t>(UringChunkSize), fileSize - nextOffset);
+            char* buffer = ring->Buffers.data() + chunk * UringChunkSize;
+            bool last = chunk + 1 == UringBatchChunks || nextOffset + length == fileSize;
+            ring->PrepareRead(fileFD, buffer, length, nextOffset, lengths.size(), true);
+            lengths.push_back(length);
+            isSend.push_back(false);
+            ring->PrepareSend(socketFD, buffer, length, lengths.size(), !last);
+            lengths.push_back(length);
+            isSend.push_back(true);
+            nextOffset += length;
+        }
+
+        vector<int> results;
+        if (!WaitForCompletions(ring, lengths.size(), results))
+        {
+            return false;
+        }
+        bool broken = false;
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            if (isSend[i] && results[i] > 0)
+            {
+                streamSent += results[i];
+            }
+            broken = broken || results[i] != static_cast<int>(lengths[i]);
+        }
+        if (broken)
+        {
+            if (streamSent < sizeof(netFileSize) &&
+                !SendAll(socketFD, reinterpret_cast<const char*>(&netFileSize) + streamSent, sizeof(netFileSize) - streamSent))
+            {
+                return false;
+            }
+            uint64_t fileSent = (streamSent > sizeof(netFileSize)) ? streamSent - sizeof(netFileSize) : 0;
+            return SendFileRange(socketFD, fileFD, fileSent, fileSize);
+        }
+    }
+    return true;
+}
+
+// Submits what is queued and collects count completions, results are indexed by user data
+bool SocketManager::WaitForCompletions(IoUring* ring, unsigned count, vector<int>& results)
+{
+    results.assign(count, 0);
+    unsigned completed = 0;
+    bool submitted = false;
+    while (completed < count)
+    {
+        uint64_t userData;
+        int result;
+        if (ring->PopCompletion(userData, result))
+        {
+            results[userData] = result;
+            completed++;
+            continue;
+        }
+        int entered = ring->SubmitAndWait(submitted ? 1 : count - completed);
+        COUNT_SEND_SYSCALL();
+        if (entered < 0)
+        {
+            errno = -entered;
+            perror("io_uring_enter");
+            return false;
+        }
+        submitted = true;
+    }
+    return true;
+}
+
 // Converts uint64_t to network byte order (big endian)
 uint64_t SocketManager::Htonll(uint64_t value)
 {
@@ -355,17 +676,98 @@ uint64_t SocketManager::Ntohll(uint64_t value)
     }
 }
 
+// Hands an open descriptor to the peer over a unix socket
+bool SocketManager::SendFD(int socketFD, int fd)
+{
+    char marker = 'F';
+    struct iovec data = { &marker, sizeof(marker) };
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+    if (sendmsg(socketFD, &message, MSG_NOSIGNAL) == -1)
+    {
+        perror("sendmsg");
+        return false;
+    }
+    return true;
+}
+
+// Only unix sockets carry descriptors, on anything else ReceiveFD would wait forever
+bool SocketManager::IsUnixSocket(int socketFD)
+{
+    struct sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    return getsockname(socketFD, reinterpret_cast<struct sockaddr*>(&address), &length) == 0 && address.ss_family == AF_UNIX;
+}
+
+bool SocketManager::ReceiveFD(int socketFD, int& fd)
+{
+    char marker;
+    struct iovec data = { &marker, sizeof(marker) };
+    char control[CMSG_SPACE(sizeof(int))];
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    fd = -1;
+    if (recvmsg(socketFD, &message, MSG_CMSG_CLOEXEC) <= 0)
+    {
+        perror("recvmsg");
+        return false;
+    }
+
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if (header == nullptr || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+    {
+        cerr << "No descriptor received" << endl;
+        return false;
+    }
+    memcpy(&fd, CMSG_DATA(header), sizeof(int));
+    return true;
+}
+
 int SocketManager::GetClientSocketFD() const
 {
     return ClientFD;
 }
 
+void SocketManager::CloseClientSocket()
+{
+    if (ClientFD != -1)
+    {
+        close(ClientFD);
+        ClientFD = -1;
+    }
+}
+
+bool SocketManager::SupportsFdPassing() const
+{
+    return ClientTransport && ClientTransport->SupportsFdPassing();
+}
+
+// Stops the listeners from taking new connections, the descriptors themselves are closed with the manager
 void SocketManager::CloseServerSocket()
 {
-    if (ServerFD != -1)
+    for (size_t i = 0; i < ServerFDs.size(); i++)
     {
-        shutdown(ServerFD, SHUT_RDWR);
-        close(ServerFD);
-        ServerFD = -1;
+        shutdown(ServerFDs[i], SHUT_RDWR);
+        Listeners[i]->Cleanup();
     }
 }
@@ -0,0 +1,144 @@
+#include "TimerWheel.h"
+#include <ctime>
+
+TimerWheel::TimerWheel(uint64_t tickMs, size_t slotCount)
+    : TickMs(tickMs), Slots(slotCount), NextTimerID(1), CurrentTick(0), StartMs(NowMs()),
+      IsRunning(false), HasThread(false)
+{
+    pthread_mutex_init(&WheelMutex, nullptr);
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&WheelChanged, &attributes);
+    pthread_condattr_destroy(&attributes);
+}
+
+TimerWheel::~TimerWheel()
+{
+    Stop();
+    pthread_mutex_destroy(&WheelMutex);
+    pthread_cond_destroy(&WheelChanged);
+}
+
+bool TimerWheel::Start()
+{
+    pthread_mutex_lock(&WheelMutex);
+    IsRunning = true;
+    HasThread = pthread_create(&WheelThread, nullptr, &TimerWheel::WheelThreadFunction, this) == 0;
+    IsRunning = HasThread;
+    pthread_mutex_unlock(&WheelMutex);
+    return HasThread;
+}
+
+// Pending timers are dropped without running
+void TimerWheel::Stop()
+{
+    pthread_mutex_lock(&WheelMutex);
+    bool joinThread = HasThread;
+    IsRunning = false;
+    HasThread = false;
+    pthread_cond_broadcast(&WheelChanged);
+    pthread_mutex_unlock(&WheelMutex);
+    if (joinThread)
+    {
+        pthread_join(WheelThread, nullptr);
+    }
+}
+
+// Returns an ID for Cancel, the callback runs no earlier than delayMs from now
+uint64_t TimerWheel::Schedule(uint64_t delayMs, function<void()> callback)
+{
+    pthread_mutex_lock(&WheelMutex);
+    uint64_t expiryTick = (NowMs() - StartMs + delayMs + TickMs - 1) / TickMs;
+    if (expiryTick <= CurrentTick)
+    {
+        expiryTick = CurrentTick + 1;
+    }
+    uint64_t timerID = NextTimerID++;
+    size_t slot = expiryTick % Slots.size();
+    Slots[slot].push_back(Timer{ timerID, expiryTick, callback });
+    TimerSlots[timerID] = slot;
+    pthread_cond_signal(&WheelChanged); // The thread sleeps without a deadline while the wheel is empty
+    pthread_mutex_unlock(&WheelMutex);
+    return timerID;
+}
+
+// Does nothing if the timer already fired
+void TimerWheel::Cancel(uint64_t timerID)
+{
+    pthread_mutex_lock(&WheelMutex);
+    auto pending = TimerSlots.find(timerID);
+    if (pending != TimerSlots.end())
+    {
+        list<Timer>& slot = Slots[pending->second];
+        for (auto timer = slot.begin(); timer != slot.end(); ++timer)
+        {
+            if (timer->ID == timerID)
+            {
+                slot.erase(timer);
+                break;
+            }
+        }
+        TimerSlots.erase(pending);
+    }
+    pthread_mutex_unlock(&WheelMutex);
+}
+
+uint64_t TimerWheel::NowMs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+void* TimerWheel::WheelThreadFunction(void* arg)
+{
+    TimerWheel* wheel = static_cast<TimerWheel*>(arg);
+    pthread_mutex_lock(&wheel->WheelMutex);
+    while (wheel->IsRunning)
+    {
+        uint64_t elapsedTicks = (NowMs() - wheel->StartMs) / wheel->TickMs;
+        if (wheel->TimerSlots.empty())
+        {
+            // Nothing to fire, skip the idle ticks instead of walking them
+            wheel->CurrentTick = elapsedTicks;
+            pthread_cond_wait(&wheel->WheelChanged, &wheel->WheelMutex);
+            continue;
+        }
+        if (wheel->CurrentTick >= elapsedTicks)
+        {
+            uint64_t nextMs = wheel->StartMs + (wheel->CurrentTick + 1) * wheel->TickMs;
+            struct timespec wakeUp;
+            wakeUp.tv_sec = nextMs / 1000;
+            wakeUp.tv_nsec = (nextMs % 1000) * 1000000;
+            pthread_cond_timedwait(&wheel->WheelChanged, &wheel->WheelMutex, &wakeUp);
+            continue;
+        }
+
+        wheel->CurrentTick++;
+        list<Timer>& slot = wheel->Slots[wheel->CurrentTick % wheel->Slots.size()];
+        vector<function<void()>> expired;
+        for (auto timer = slot.begin(); timer != slot.end();)
+        {
+            if (timer->ExpiryTick <= wheel->CurrentTick) // Later rounds stay in the slot
+            {
+                expired.push_back(timer->Callback);
+                wheel->TimerSlots.erase(timer->ID);
+                timer = slot.erase(timer);
+            }
+            else
+            {
+                ++timer;
+            }
+        }
+
+        pthread_mutex_unlock(&wheel->WheelMutex);
+        for (auto& callback : expired)
+        {
+            callback();
+        }
+        pthread_mutex_lock(&wheel->WheelMutex);
+    }
+    pthread_mutex_unlock(&wheel->WheelMutex);
+    return nullptr;
+}
@@ -0,0 +1,150 @@
+#include "Tracer.h"
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <ctime>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+static const size_t TraceRingSize = 8192; // Events kept per thread, older ones are overwritten
+
+// One event behind a seqlock: Sequence is odd while the writer fills the slot. The fields are atomics
+// so a dump racing with the writer reads mixed values, which the sequence recheck then throws away.
+struct TraceSlot
+{
+    atomic<uint64_t> Sequence;
+    atomic<const char*> Name;
+    atomic<uint64_t> Start;
+    atomic<uint64_t> Duration;
+    atomic<int> ThreadID;
+};
+
+struct TraceRing
+{
+    atomic<uint64_t> Head;
+    TraceSlot Slots[TraceRingSize];
+};
+
+// Rings outlive their threads: a finished thread hands its ring to the next one, so short-lived
+// client handlers do not grow memory and their events stay dumpable
+static pthread_mutex_t RingsMutex = PTHREAD_MUTEX_INITIALIZER;
+static vector<TraceRing*> AllRings;
+static vector<TraceRing*> FreeRings;
+
+struct RingLease
+{
+    TraceRing* Ring = nullptr;
+    int ThreadID = 0;
+
+    ~RingLease()
+    {
+        if (Ring != nullptr)
+        {
+            pthread_mutex_lock(&RingsMutex);
+            FreeRings.push_back(Ring);
+            pthread_mutex_unlock(&RingsMutex);
+        }
+    }
+};
+
+static thread_local RingLease CurrentLease;
+
+atomic<bool> Tracer::Enabled(false);
+
+void Tracer::SetEnabled(bool enabled)
+{
+    Enabled.store(enabled, memory_order_relaxed);
+}
+
+uint64_t Tracer::Now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+void Tracer::Record(const char* name, uint64_t start, uint64_t end)
+{
+    RingLease& lease = CurrentLease;
+    if (lease.Ring == nullptr)
+    {
+        pthread_mutex_lock(&RingsMutex);
+        if (FreeRings.empty())
+        {
+            TraceRing* ring = new TraceRing();
+            ring->Head.store(0);
+            for (TraceSlot& slot : ring->Slots)
+            {
+                slot.Sequence.store(0);
+                slot.Name.store(nullptr);
+            }
+            AllRings.push_back(ring);
+            FreeRings.push_back(ring);
+        }
+        lease.Ring = FreeRings.back();
+        FreeRings.pop_back();
+        pthread_mutex_unlock(&RingsMutex);
+        lease.ThreadID = syscall(SYS_gettid);
+    }
+
+    TraceRing* ring = lease.Ring;
+    uint64_t head = ring->Head.load(memory_order_relaxed);
+    TraceSlot& slot = ring->Slots[head % TraceRingSize];
+    uint64_t sequence = slot.Sequence.load(memory_order_relaxed);
+    slot.Sequence.store(sequence + 1, memory_order_relaxed);
+    slot.Name.store(name, memory_order_release); // Release keeps the odd sequence ahead of the fields
+    slot.Start.store(start, memory_order_release);
+    slot.Duration.store(end - start, memory_order_release);
+    slot.ThreadID.store(lease.ThreadID, memory_order_release);
+    slot.Sequence.store(sequence + 2, memory_order_release);
+    ring->Head.store(head + 1, memory_order_release);
+}
+
+// Copies a slot, false when the writer was in it before or during the copy
+static bool ReadSlot(const TraceSlot& slot, TraceEvent& event)
+{
+    uint64_t before = slot.Sequence.load(memory_order_acquire);
+    if (before % 2 != 0)
+    {
+        return false;
+    }
+    event.Name = slot.Name.load(memory_order_acquire); // Acquire keeps the recheck behind the fields
+    event.Start = slot.Start.load(memory_order_acquire);
+    event.Duration = slot.Duration.load(memory_order_acquire);
+    event.ThreadID = slot.ThreadID.load(memory_order_acquire);
+    return slot.Sequence.load(memory_order_relaxed) == before && event.Name != nullptr;
+}
+
+string Tracer::DumpChromeJson()
+{
+    ostringstream json;
+    json << fixed << setprecision(3) << "{\"traceEvents\":[";
+    bool first = true;
+    int pid = getpid();
+
+    pthread_mutex_lock(&RingsMutex);
+    vector<TraceRing*> rings = AllRings;
+    pthread_mutex_unlock(&RingsMutex);
+
+    for (TraceRing* ring : rings)
+    {
+        uint64_t head = ring->Head.load(memory_order_acquire);
+        uint64_t count = head < TraceRingSize ? head : TraceRingSize;
+        for (uint64_t i = head - count; i < head; i++)
+        {
+            TraceEvent event;
+            if (!ReadSlot(ring->Slots[i % TraceRingSize], event))
+            {
+                continue; // Overwritten while we copied it
+            }
+            json << (first ? "" : ",") << "\n{\"name\":\"" << event.Name << "\",\"ph\":\"X\",\"ts\":"
+                 << event.Start / 1000.0 << ",\"dur\":" << event.Duration / 1000.0
+                 << ",\"pid\":" << pid << ",\"tid\":" << event.ThreadID << "}";
+            first = false;
+        }
+    }
+
+    json << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return json.str();
+}
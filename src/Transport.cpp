@@ -0,0 +1,345 @@
+#include "Transport.h"
+#include <iostream>
+#include <cstring>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <netinet/in.h>
+#include <unistd.h>
+
+static const string UnixPrefix = "unix:";
+
+// "unix:<path>" selects a local socket, anything else is a TCP host name
+unique_ptr<Transport> Transport::Create(const string& serverName, const string& port)
+{
+    if (serverName.compare(0, UnixPrefix.length(), UnixPrefix) == 0)
+    {
+        return unique_ptr<Transport>(new UnixTransport(serverName.substr(UnixPrefix.length())));
+    }
+    return unique_ptr<Transport>(new TcpTransport(serverName, port));
+}
+
+// Accepts "host", "host:port", "[v6 address]:port" and "unix:<path>", which never has a port
+bool Transport::SplitHostPort(const string& address, const string& defaultPort, string& host, string& port)
+{
+    host = address;
+    port = defaultPort;
+    if (address.compare(0, UnixPrefix.length(), UnixPrefix) == 0)
+    {
+        port = "";
+        return address.length() > UnixPrefix.length();
+    }
+
+    size_t colon = address.rfind(':');
+    if (!address.empty() && address[0] == '[')
+    {
+        size_t bracket = address.find(']');
+        if (bracket == string::npos)
+        {
+            return false;
+        }
+        host = address.substr(1, bracket - 1);
+        if (colon != string::npos && colon > bracket)
+        {
+            port = address.substr(colon + 1);
+        }
+    }
+    else if (colon != string::npos && address.find(':') == colon) // A bare IPv6 address has several colons
+    {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+    }
+    return !host.empty() && !port.empty();
+}
+
+TcpTransport::TcpTransport(const string& host, const string& port, bool reusePort)
+    : Host(host), Port(port), ReusePort(reusePort)
+{
+}
+
+int TcpTransport::Connect()
+{
+    struct addrinfo hints;
+    struct addrinfo* addrInfo = nullptr;
+    int status;
+    char ipString[INET6_ADDRSTRLEN];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;      // IPv4 or IPv6, whatever the name resolves to
+    hints.ai_socktype = SOCK_STREAM;  // TCP stream sockets
+
+    if ((status = getaddrinfo(Host.c_str(), Port.c_str(), &hints, &addrInfo)) != 0)
+    {
+        cerr << "getaddrinfo: " << gai_strerror(status) << endl;
+        return -1;
+    }
+
+    int socketFD = -1;
+    for (struct addrinfo* p = addrInfo; p != NULL; p = p->ai_next)
+    {
+        void* address;
+        string ipVersion;
+
+        if (p->ai_family == AF_INET)
+        {
+            struct sockaddr_in* ipv4 = (struct sockaddr_in*)p->ai_addr;
+            address = &(ipv4->sin_addr);
+            ipVersion = "IPv4";
+        }
+        else if (p->ai_family == AF_INET6)
+        {
+            struct sockaddr_in6* ipv6 = (struct sockaddr_in6*)p->ai_addr;
+            address = &(ipv6->sin6_addr);
+            ipVersion = "IPv6";
+        }
+        else
+        {
+            continue; // Skip unknown address families
+        }
+
+        inet_ntop(p->ai_family, address, ipString, sizeof(ipString));
+        cerr << "  " << ipVersion << ": " << ipString << endl;
+
+        socketFD = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol);
+        if (socketFD == -1)
+        {
+            perror("socket");
+            continue; // Try the next address in case of error
+        }
+
+        if (connect(socketFD, p->ai_addr, p->ai_addrlen) == -1)
+        {
+            close(socketFD);
+            socketFD = -1;
+            perror("connect");
+            continue; // Try the next address in case of error
+        }
+
+        cerr << "Successfully connected to " << Host << " on port " << Port << " (" << ipVersion << ")\n";
+        break;
+    }
+
+    freeaddrinfo(addrInfo);
+    if (socketFD == -1)
+    {
+        cerr << "Failed to connect to any address.\n";
+    }
+    return socketFD;
+}
+
+// Binds a dual-stack IPv6 wildcard socket, or plain IPv4 on hosts without IPv6
+int TcpTransport::Listen(int backlog)
+{
+    struct addrinfo hints;
+    struct addrinfo* addrInfo = nullptr;
+    int status;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;      // For wildcard IP address
+
+    if ((status = getaddrinfo(Host.empty() ? NULL : Host.c_str(), Port.c_str(), &hints, &addrInfo)) != 0)
+    {
+        cerr << "getaddrinfo: " << gai_strerror(status) << endl;
+        return -1;
+    }
+
+    int socketFD = -1;
+    for (int family : { AF_INET6, AF_INET })
+    {
+        for (struct addrinfo* p = addrInfo; p != NULL && socketFD == -1; p = p->ai_next)
+        {
+            if (p->ai_family != family)
+            {
+                continue;
+            }
+
+            socketFD = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, p->ai_protocol);
+            if (socketFD == -1)
+            {
+                continue; // IPv6 may be disabled, fall back to IPv4
+            }
+
+            int yes = 1;
+            int no = 0;
+            if (setsockopt(socketFD, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1 ||
+                (ReusePort && setsockopt(socketFD, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == -1) ||
+                (family == AF_INET6 && setsockopt(socketFD, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(int)) == -1))
+            {
+                perror("setsockopt");
+                close(socketFD);
+                socketFD = -1;
+                continue;
+            }
+
+            if (bind(socketFD, p->ai_addr, p->ai_addrlen) == -1)
+            {
+                perror("bind");
+                close(socketFD);
+                socketFD = -1;
+            }
+        }
+    }
+    freeaddrinfo(addrInfo);
+
+    if (socketFD == -1)
+    {
+        cerr << "Failed to bind any address.\n";
+        return -1;
+    }
+
+    if (listen(socketFD, backlog) == -1)
+    {
+        perror("listen");
+        close(socketFD);
+        return -1;
+    }
+
+    return socketFD;
+}
+
+string TcpTransport::Describe() const
+{
+    return "port " + Port;
+}
+
+UnixTransport::UnixTransport(const string& path) : Path(path), IsBound(false)
+{
+}
+
+bool UnixTransport::FillAddress(struct sockaddr_un& address) const
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (Path.empty() || Path.length() >= sizeof(address.sun_path))
+    {
+        cerr << "Invalid unix socket path: " << Path << endl;
+        return false;
+    }
+    strncpy(address.sun_path, Path.c_str(), sizeof(address.sun_path) - 1);
+    return true;
+}
+
+int UnixTransport::Connect()
+{
+    struct sockaddr_un address;
+    if (!FillAddress(address))
+    {
+        return -1;
+    }
+
+    int socketFD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socketFD == -1)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    if (connect(socketFD, (struct sockaddr*)&address, sizeof(address)) == -1)
+    {
+        perror("connect");
+        close(socketFD);
+        return -1;
+    }
+
+    cerr << "Successfully connected to " << Path << " (unix)\n";
+    return socketFD;
+}
+
+int UnixTransport::Listen(int backlog)
+{
+    struct sockaddr_un address;
+    if (!FillAddress(address))
+    {
+        return -1;
+    }
+
+    int socketFD = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (socketFD == -1)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    if (!RemoveStaleSocket())
+    {
+        close(socketFD);
+        return -1;
+    }
+    if (bind(socketFD, (struct sockaddr*)&address, sizeof(address)) == -1)
+    {
+        perror("bind");
+        close(socketFD);
+        return -1;
+    }
+    IsBound = true;
+
+    if (listen(socketFD, backlog) == -1)
+    {
+        perror("listen");
+        close(socketFD);
+        Cleanup();
+        return -1;
+    }
+
+    return socketFD;
+}
+
+// Removes a socket left by a previous run. Anything that is not a socket, or a socket some
+// server still answers on, is left alone and fails the listen.
+bool UnixTransport::RemoveStaleSocket()
+{
+    struct stat status;
+    if (lstat(Path.c_str(), &status) == -1)
+    {
+        return errno == ENOENT;
+    }
+    if (!S_ISSOCK(status.st_mode))
+    {
+        cerr << Path << " exists and is not a socket" << endl;
+        return false;
+    }
+
+    struct sockaddr_un address;
+    int probeFD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probeFD == -1 || !FillAddress(address))
+    {
+        if (probeFD != -1)
+        {
+            close(probeFD);
+        }
+        return false;
+    }
+    bool inUse = connect(probeFD, (struct sockaddr*)&address, sizeof(address)) == 0;
+    close(probeFD);
+    if (inUse)
+    {
+        cerr << "Another server is listening on " << Path << endl;
+        return false;
+    }
+    unlink(Path.c_str());
+    return true;
+}
+
+void UnixTransport::Cleanup()
+{
+    if (IsBound)
+    {
+        unlink(Path.c_str());
+        IsBound = false;
+    }
+}
+
+void UnixTransport::Adopt()
+{
+    IsBound = true;
+}
+
+string UnixTransport::Describe() const
+{
+    return "unix socket " + Path;
+}
@@ -0,0 +1,374 @@
+#include "Zygote.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <vector>
+#include <sstream>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sched.h>
+
+static const size_t ZygoteMessageSize = 65536; // Requests are single SOCK_SEQPACKET messages
+
+static const size_t ZygoteMaxFDs = 2; // Job output, and optionally its stdin
+
+static bool SendRequest(int controlFD, const string& message, const vector<int>& fds)
+{
+    struct iovec data = { const_cast<char*>(message.data()), message.length() };
+    char control[CMSG_SPACE(sizeof(int) * ZygoteMaxFDs)];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &data;
+    header.msg_iovlen = 1;
+    if (!fds.empty())
+    {
+        header.msg_control = control;
+        header.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+        struct cmsghdr* rights = CMSG_FIRSTHDR(&header);
+        rights->cmsg_level = SOL_SOCKET;
+        rights->cmsg_type = SCM_RIGHTS;
+        rights->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(rights), fds.data(), sizeof(int) * fds.size());
+    }
+    return sendmsg(controlFD, &header, MSG_NOSIGNAL) == static_cast<ssize_t>(message.length());
+}
+
+static ssize_t ReceiveRequest(int controlFD, vector<char>& buffer, vector<int>& fds)
+{
+    struct iovec data = { buffer.data(), buffer.size() };
+    char control[CMSG_SPACE(sizeof(int) * ZygoteMaxFDs)];
+
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &data;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+
+    fds.clear();
+    ssize_t received = recvmsg(controlFD, &header, MSG_CMSG_CLOEXEC);
+    struct cmsghdr* rights = (received > 0) ? CMSG_FIRSTHDR(&header) : nullptr;
+    if (rights != nullptr && rights->cmsg_level == SOL_SOCKET && rights->cmsg_type == SCM_RIGHTS)
+    {
+        fds.resize((rights->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        memcpy(fds.data(), CMSG_DATA(rights), sizeof(int) * fds.size());
+    }
+    return received;
+}
+
+Zygote::Zygote() : HelperPID(-1), ControlFD(-1), NextRequestID(0), IsAlive(false)
+{
+    pthread_mutex_init(&ZygoteMutex, nullptr);
+    pthread_cond_init(&StateChanged, nullptr);
+}
+
+Zygote::~Zygote()
+{
+    if (HelperPID > 0)
+    {
+        shutdown(ControlFD, SHUT_RDWR); // The helper exits on EOF, which also ends the reader thread
+        pthread_join(ReaderThread, nullptr);
+        close(ControlFD);
+        waitpid(HelperPID, nullptr, 0);
+    }
+    pthread_mutex_destroy(&ZygoteMutex);
+    pthread_cond_destroy(&StateChanged);
+}
+
+// Must run before the caller creates any thread or opens any client socket
+bool Zygote::Start()
+{
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1)
+    {
+        perror("socketpair");
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(sockets[0]);
+        HelperLoop(sockets[1]);
+        _exit(EXIT_SUCCESS);
+    }
+    close(sockets[1]);
+    if (pid < 0)
+    {
+        perror("fork");
+        close(sockets[0]);
+        return false;
+    }
+
+    HelperPID = pid;
+    ControlFD = sockets[0];
+    IsAlive = true;
+    pthread_create(&ReaderThread, nullptr, &Zygote::ReaderThreadFunction, this);
+    return true;
+}
+
+bool Zygote::IsRunning()
+{
+    pthread_mutex_lock(&ZygoteMutex);
+    bool alive = IsAlive;
+    pthread_mutex_unlock(&ZygoteMutex);
+    return alive;
+}
+
+// Returns the pid of the job, or -1 if the helper could not start it. mayHaveStarted is set when
+// the request reached a helper that died before answering, the job must not be started again then.
+pid_t Zygote::Spawn(const string& command, int outputFD, int inputFD, const vector<int>& cpus, bool& mayHaveStarted)
+{
+    mayHaveStarted = false;
+    string cpuList;
+    for (int cpu : cpus)
+    {
+        cpuList += (cpuList.empty() ? "" : ",") + to_string(cpu);
+    }
+
+    pthread_mutex_lock(&ZygoteMutex);
+    int requestID = NextRequestID++;
+    string request = "SPAWN " + to_string(requestID) + " " + (cpuList.empty() ? "-" : cpuList) + "\n" + command;
+    vector<int> fds = { outputFD };
+    if (inputFD >= 0)
+    {
+        fds.push_back(inputFD);
+    }
+    if (!IsAlive || request.length() > ZygoteMessageSize || !SendRequest(ControlFD, request, fds))
+    {
+        pthread_mutex_unlock(&ZygoteMutex);
+        return -1;
+    }
+
+    while (IsAlive && SpawnResults.find(requestID) == SpawnResults.end())
+    {
+        pthread_cond_wait(&StateChanged, &ZygoteMutex);
+    }
+    pid_t pid = -1;
+    auto result = SpawnResults.find(requestID);
+    if (result != SpawnResults.end())
+    {
+        pid = result->second;
+        SpawnResults.erase(result);
+    }
+    else
+    {
+        mayHaveStarted = true;
+    }
+    pthread_mutex_unlock(&ZygoteMutex);
+
+    if (mayHaveStarted)
+    {
+        cerr << "Zygote exited while spawning a job" << endl;
+        return -1;
+    }
+    if (pid < 0)
+    {
+        cerr << "Zygote failed to spawn job: " << strerror(-pid) << endl;
+        return -1;
+    }
+    return pid;
+}
+
+bool Zygote::Wait(pid_t pid, int& status)
+{
+    pthread_mutex_lock(&ZygoteMutex);
+    while (IsAlive && ExitStatuses.find(pid) == ExitStatuses.end())
+    {
+        pthread_cond_wait(&StateChanged, &ZygoteMutex);
+    }
+    auto exitStatus = ExitStatuses.find(pid);
+    bool found = exitStatus != ExitStatuses.end();
+    if (found)
+    {
+        status = exitStatus->second;
+        ExitStatuses.erase(exitStatus);
+    }
+    Children.erase(pid);
+    pthread_mutex_unlock(&ZygoteMutex);
+    return found;
+}
+
+void* Zygote::ReaderThreadFunction(void* arg)
+{
+    Zygote* zygote = static_cast<Zygote*>(arg);
+    vector<char> buffer(ZygoteMessageSize);
+
+    while (true)
+    {
+        ssize_t received = recv(zygote->ControlFD, buffer.data(), buffer.size(), 0);
+        if (received <= 0)
+        {
+            break;
+        }
+
+        istringstream reply(string(buffer.data(), received));
+        string kind;
+        long first;
+        long second;
+        reply >> kind >> first >> second;
+
+        pthread_mutex_lock(&zygote->ZygoteMutex);
+        if (kind == "SPAWNED")
+        {
+            zygote->SpawnResults[first] = second;
+            zygote->Children.insert(second);
+        }
+        else if (kind == "FAILED")
+        {
+            zygote->SpawnResults[first] = -second;
+        }
+        else if (kind == "EXITED" && zygote->Children.count(first) > 0)
+        {
+            zygote->ExitStatuses[first] = second;
+        }
+        pthread_cond_broadcast(&zygote->StateChanged);
+        pthread_mutex_unlock(&zygote->ZygoteMutex);
+    }
+
+    pthread_mutex_lock(&zygote->ZygoteMutex);
+    zygote->IsAlive = false;
+    pthread_cond_broadcast(&zygote->StateChanged);
+    pthread_mutex_unlock(&zygote->ZygoteMutex);
+    return nullptr;
+}
+
+// Serves spawn requests and reports exits until the server closes its end of the socket
+void Zygote::HelperLoop(int controlFD)
+{
+    sigset_t childSignal;
+    sigemptyset(&childSignal);
+    sigaddset(&childSignal, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childSignal, nullptr);
+    int signalFD = signalfd(-1, &childSignal, SFD_CLOEXEC);
+    if (signalFD == -1)
+    {
+        perror("signalfd");
+        return;
+    }
+
+    vector<char> buffer(ZygoteMessageSize);
+    struct pollfd pollFDs[2] = { { controlFD, POLLIN, 0 }, { signalFD, POLLIN, 0 } };
+    while (true)
+    {
+        if (poll(pollFDs, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            return;
+        }
+
+        if (pollFDs[1].revents & POLLIN)
+        {
+            struct signalfd_siginfo info; // Only a wake-up, the exits themselves are collected with waitpid
+            if (read(signalFD, &info, sizeof(info)) != sizeof(info))
+            {
+                continue;
+            }
+            int status;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+            {
+                SendRequest(controlFD, "EXITED " + to_string(pid) + " " + to_string(status), {});
+            }
+        }
+
+        if (pollFDs[0].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            vector<int> fds;
+            ssize_t received = ReceiveRequest(controlFD, buffer, fds);
+            int outputFD = (fds.size() > 0) ? fds[0] : -1;
+            int inputFD = (fds.size() > 1) ? fds[1] : -1;
+            if (received <= 0)
+            {
+                return; // The server is gone
+            }
+
+            string request(buffer.data(), received);
+            size_t newline = request.find('\n');
+            string command = (newline == string::npos) ? "" : request.substr(newline + 1);
+            istringstream requestLine(request.substr(0, newline));
+            string kind;
+            string requestID;
+            string cpuList;
+            requestLine >> kind >> requestID >> cpuList;
+            vector<int> cpus;
+            istringstream cpuStream(cpuList == "-" ? "" : cpuList);
+            string cpu;
+            while (getline(cpuStream, cpu, ','))
+            {
+                cpus.push_back(stoi(cpu));
+            }
+
+            pid_t pid = fork();
+            int forkError = errno;
+            if (pid == 0)
+            {
+                sigprocmask(SIG_UNBLOCK, &childSignal, nullptr);
+                RunChild(command, outputFD, inputFD, cpus);
+            }
+            for (int fd : fds)
+            {
+                close(fd);
+            }
+
+            if (pid > 0)
+            {
+                SendRequest(controlFD, "SPAWNED " + requestID + " " + to_string(pid), {});
+            }
+            else
+            {
+                SendRequest(controlFD, "FAILED " + requestID + " " + to_string(forkError), {});
+            }
+        }
+    }
+}
+
+// Sets up a freshly forked job process and execs its command, never returns. Shared by the
+// helper and the server's own fork fallback.
+void Zygote::RunChild(const string& command, int outputFD, int inputFD, const vector<int>& cpus)
+{
+    setpgid(0, 0); // Own process group, so a timeout kills everything the job started
+    ApplyAffinity(cpus);
+    if (outputFD >= 0 && (dup2(outputFD, STDOUT_FILENO) == -1 || dup2(outputFD, STDERR_FILENO) == -1))
+    {
+        perror("Failed to duplicate file descriptor to STDOUT");
+        _exit(EXIT_FAILURE);
+    }
+    if (inputFD >= 0 && dup2(inputFD, STDIN_FILENO) == -1)
+    {
+        perror("Failed to duplicate file descriptor to STDIN");
+        _exit(EXIT_FAILURE);
+    }
+    execlp("/bin/sh", "sh", "-c", command.c_str(), nullptr);
+    perror("Failed to execute command");
+    _exit(EXIT_FAILURE);
+}
+
+// Pins the calling process, an empty set leaves it wherever the kernel puts it
+void Zygote::ApplyAffinity(const vector<int>& cpus)
+{
+    if (cpus.empty())
+    {
+        return;
+    }
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (int cpu : cpus)
+    {
+        CPU_SET(cpu, &mask);
+    }
+    if (sched_setaffinity(0, sizeof(mask), &mask) == -1)
+    {
+        perror("sched_setaffinity");
+    }
+}
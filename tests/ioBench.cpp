@@ -0,0 +1,162 @@
+#include "SocketManager.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+using namespace std;
+
+// Send path benchmark over loopback TCP: the same messages and spool files go out with blocking
+// calls and then with io_uring enabled, and the send side syscalls of each run are compared.
+// Messages take the blocking sendmsg either way, only the files go through the ring.
+struct ReceiverArgs
+{
+    int SocketFD;
+    int Messages;
+    int Files;
+    string CopyPath; // The first file of a run is kept here to check it arrived intact
+    bool Success;
+};
+
+static void* ReceiverThread(void* arg)
+{
+    ReceiverArgs* args = static_cast<ReceiverArgs*>(arg);
+    SocketManager receiver;
+    int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    int copyFD = open(args->CopyPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    args->Success = devNull != -1 && copyFD != -1;
+    string message;
+    for (int i = 0; i < args->Messages && args->Success; i++)
+    {
+        args->Success = receiver.ReceiveMessage(args->SocketFD, message);
+    }
+    for (int i = 0; i < args->Files && args->Success; i++)
+    {
+        args->Success = receiver.ReceiveFileData(args->SocketFD, i == 0 ? copyFD : devNull);
+    }
+    close(devNull);
+    close(copyFD);
+    return nullptr;
+}
+
+// A connected loopback TCP pair, the receiving end comes back in peerFD
+static int ConnectLoopback(int& peerFD)
+{
+    int listenFD = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (listenFD == -1 || bind(listenFD, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 ||
+        listen(listenFD, 1) == -1 || getsockname(listenFD, reinterpret_cast<sockaddr*>(&address), &length) == -1)
+    {
+        perror("listen");
+        return -1;
+    }
+    int socketFD = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socketFD == -1 || connect(socketFD, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+    {
+        perror("connect");
+        return -1;
+    }
+    peerFD = accept4(listenFD, nullptr, nullptr, SOCK_CLOEXEC);
+    close(listenFD);
+    return peerFD == -1 ? -1 : socketFD;
+}
+
+static bool SameContents(const string& first, const string& second)
+{
+    ifstream a(first, ios::binary);
+    ifstream b(second, ios::binary);
+    return string(istreambuf_iterator<char>(a), {}) == string(istreambuf_iterator<char>(b), {});
+}
+
+static bool RunMode(bool useRing, const string& spoolFile, uint64_t spoolBytes, int messages, int files)
+{
+    IoUring::SetEnabled(useRing);
+    IoUring::AllowForThisThread();
+    if (useRing && IoUring::ForThread() == nullptr)
+    {
+        cout << "io_uring: not available on this kernel, skipped" << endl;
+        return true;
+    }
+
+    int peerFD;
+    int socketFD = ConnectLoopback(peerFD);
+    if (socketFD == -1)
+    {
+        return false;
+    }
+    ReceiverArgs args{ peerFD, messages, files, spoolFile + ".copy", false };
+    pthread_t receiver;
+    pthread_create(&receiver, nullptr, ReceiverThread, &args);
+
+    SocketManager sender;
+    string message = "JOB job_1 FINISHED status 0";
+    bool success = true;
+    uint64_t startSyscalls = SocketManager::GetSendSyscalls();
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < messages && success; i++)
+    {
+        success = sender.SendMessage(socketFD, message);
+    }
+    double messageSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    uint64_t messageSyscalls = SocketManager::GetSendSyscalls() - startSyscalls;
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < files && success; i++)
+    {
+        success = sender.SendFileData(socketFD, spoolFile);
+    }
+    pthread_join(receiver, nullptr);
+    double fileSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    uint64_t fileSyscalls = SocketManager::GetSendSyscalls() - startSyscalls - messageSyscalls;
+    close(socketFD);
+    close(peerFD);
+
+    success = success && args.Success && SameContents(spoolFile, args.CopyPath);
+    unlink(args.CopyPath.c_str());
+    double megabytes = static_cast<double>(spoolBytes) * files / (1 << 20);
+    cout << (useRing ? "io_uring: " : "blocking: ") << messages << " messages " << messageSyscalls << " syscalls "
+         << messages / messageSeconds << " msg/s, " << files << " files " << fileSyscalls << " syscalls "
+         << megabytes / fileSeconds << " MB/s" << (success ? "" : " FAILED") << endl;
+    return success;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " <spoolMB> [files] [messages]" << endl;
+        return EXIT_FAILURE;
+    }
+    uint64_t spoolBytes = stoull(argv[1]) << 20;
+    int files = argc > 2 ? stoi(argv[2]) : 20;
+    int messages = argc > 3 ? stoi(argv[3]) : 20000;
+
+    // Odd tail so the last chunk of each batch is a short one
+    string spoolFile = "ioBench." + to_string(getpid()) + ".spool";
+    {
+        ofstream spool(spoolFile, ios::binary);
+        string block(4096, 'x');
+        for (uint64_t written = 0; written < spoolBytes; written += block.size())
+        {
+            block[written / block.size() % block.size()]++;
+            spool.write(block.data(), block.size());
+        }
+        spool << "tail";
+        spoolBytes += 4;
+    }
+
+    bool success = RunMode(false, spoolFile, spoolBytes, messages, files) &&
+                   RunMode(true, spoolFile, spoolBytes, messages, files);
+    unlink(spoolFile.c_str());
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,86 @@
+#include "SocketManager.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <pthread.h>
+using namespace std;
+
+// Load generator: several clients each submit jobs back to back and wait for their output
+struct BenchArgs
+{
+    string Host;
+    string Port;
+    string Command;
+    int Jobs;
+};
+
+static atomic<int> CompletedJobs(0);
+static atomic<int> FailedJobs(0);
+
+static void* ClientThread(void* arg)
+{
+    BenchArgs* args = static_cast<BenchArgs*>(arg);
+    int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    for (int i = 0; i < args->Jobs; i++)
+    {
+        SocketManager connection;
+        if (!connection.ResolveAndConnect(args->Host, args->Port))
+        {
+            FailedJobs++;
+            continue;
+        }
+
+        int socketFD = connection.GetClientSocketFD();
+        string submitted;
+        string header;
+        string footer;
+        bool success = connection.SendMessage(socketFD, "issueJob " + args->Command) &&
+                       connection.ReceiveMessage(socketFD, submitted) &&
+                       connection.ReceiveMessage(socketFD, header) &&
+                       header.find("output start") != string::npos &&
+                       connection.ReceiveFileData(socketFD, devNull) &&
+                       connection.ReceiveMessage(socketFD, footer);
+        success ? CompletedJobs++ : FailedJobs++;
+    }
+
+    close(devNull);
+    return nullptr;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 5)
+    {
+        cerr << "Usage: " << argv[0] << " <serverName> <portNum> <clients> <jobsPerClient> [command]" << endl;
+        return EXIT_FAILURE;
+    }
+
+    int clients = stoi(argv[3]);
+    BenchArgs args{ argv[1], argv[2], argc > 5 ? argv[5] : "true", stoi(argv[4]) };
+
+    // The connection chatter of SocketManager would drown the results
+    cout.setstate(ios::failbit);
+    cerr.setstate(ios::failbit);
+    auto start = chrono::steady_clock::now();
+
+    vector<pthread_t> threads(clients);
+    for (auto& thread : threads)
+    {
+        pthread_create(&thread, nullptr, ClientThread, &args);
+    }
+    for (auto& thread : threads)
+    {
+        pthread_join(thread, nullptr);
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout.clear();
+    cerr.clear();
+    cout << "jobs " << CompletedJobs << " failed " << FailedJobs << " in " << seconds << " s, "
+         << CompletedJobs / seconds << " jobs/s" << endl;
+    return FailedJobs == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,456 @@
+#include "SocketManager.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <cstring>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+using namespace std;
+
+// Stress harness: starts a server, hammers it from many clients with issueJob, stop, poll and
+// setConcurrency, then races a final round of submissions against exit. Checks that job IDs are
+// unique, every submitted job gets exactly one terminal response, echo jobs return what they
+// printed, the server holds no more fds once idle than before the load, and that it exits cleanly.
+// Meant to be run on sanitizer builds as well, see the stress targets in the Makefile.
+struct StressArgs
+{
+    string Port;
+    int Operations;
+    bool IssueOnly;
+    unsigned Seed;
+};
+
+static const int ReceiveTimeoutSeconds = 30; // A server that stops answering shows up as a violation, not a hang
+
+static pthread_mutex_t ResultsMutex = PTHREAD_MUTEX_INITIALIZER;
+static map<string, int> Terminals; // Submitted job ID to the terminal responses it got
+static vector<string> RecentIDs; // Targets for stop
+static vector<string> Violations;
+
+static atomic<int> OperationCount(0);
+static atomic<int> CompletedJobs(0);
+static atomic<int> RemovedJobs(0);
+static atomic<int> TerminatedJobs(0);
+static atomic<int> RejectedJobs(0); // Turned away at shutdown before getting an ID
+static atomic<int> EchoCounter(0);
+
+static void AddViolation(const string& violation)
+{
+    pthread_mutex_lock(&ResultsMutex);
+    if (Violations.size() < 20)
+    {
+        Violations.push_back(violation);
+    }
+    else if (Violations.size() == 20)
+    {
+        Violations.push_back("...");
+    }
+    pthread_mutex_unlock(&ResultsMutex);
+}
+
+static int Connect(SocketManager& connection, const string& port)
+{
+    if (!connection.ResolveAndConnect("localhost", port))
+    {
+        return -1;
+    }
+    int socketFD = connection.GetClientSocketFD();
+    struct timeval timeout = { ReceiveTimeoutSeconds, 0 };
+    setsockopt(socketFD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return socketFD;
+}
+
+// True once the server has closed its end, after the last response
+static bool AtEnd(int socketFD)
+{
+    char extra;
+    return recv(socketFD, &extra, sizeof(extra), 0) == 0;
+}
+
+static void RecordTerminal(const string& jobID)
+{
+    pthread_mutex_lock(&ResultsMutex);
+    Terminals[jobID]++;
+    pthread_mutex_unlock(&ResultsMutex);
+}
+
+static void IssueJob(const string& port, mt19937& random, int outputFD)
+{
+    SocketManager connection;
+    int socketFD = Connect(connection, port);
+    if (socketFD < 0)
+    {
+        RejectedJobs++; // Only expected while the server shuts down, checked by the caller
+        return;
+    }
+
+    string expected;
+    string command;
+    switch (random() % 4)
+    {
+    case 0:
+        command = "sleep 0.0" + to_string(random() % 5 + 1);
+        break;
+    case 1:
+        command = "true";
+        break;
+    default:
+        expected = to_string(EchoCounter++);
+        command = "echo " + expected;
+        expected += "\n";
+        break;
+    }
+
+    string reply;
+    if (!connection.SendMessage(socketFD, "issueJob " + command) || !connection.ReceiveMessage(socketFD, reply))
+    {
+        RejectedJobs++;
+        return;
+    }
+    if (reply == "SERVER TERMINATED BEFORE EXECUTION")
+    {
+        RejectedJobs++;
+        if (!AtEnd(socketFD))
+        {
+            AddViolation("response after a rejection: " + command);
+        }
+        return;
+    }
+    size_t comma = reply.find(',');
+    if (reply.compare(0, 4, "JOB ") != 0 || comma == string::npos || reply.find(" SUBMITTED") == string::npos)
+    {
+        AddViolation("unexpected reply to issueJob: " + reply);
+        return;
+    }
+
+    string jobID = reply.substr(4, comma - 4);
+    pthread_mutex_lock(&ResultsMutex);
+    bool duplicate = Terminals.count(jobID) > 0;
+    Terminals[jobID];
+    RecentIDs.push_back(jobID);
+    if (RecentIDs.size() > 64)
+    {
+        RecentIDs.erase(RecentIDs.begin());
+    }
+    pthread_mutex_unlock(&ResultsMutex);
+    if (duplicate)
+    {
+        AddViolation("duplicate job ID " + jobID);
+    }
+
+    if (!connection.ReceiveMessage(socketFD, reply))
+    {
+        AddViolation("no terminal response for " + jobID);
+        return;
+    }
+    if (reply == "-----" + jobID + " output start------\n")
+    {
+        string footer;
+        ftruncate(outputFD, 0);
+        lseek(outputFD, 0, SEEK_SET);
+        if (!connection.ReceiveFileData(socketFD, outputFD) || !connection.ReceiveMessage(socketFD, footer) ||
+            footer.find("-----" + jobID + " output end------") != 0)
+        {
+            AddViolation("truncated output for " + jobID);
+            return;
+        }
+        string output(expected.size() + 1, '\0');
+        ssize_t length = pread(outputFD, &output[0], output.size(), 0);
+        if (!expected.empty() && (length < 0 || output.substr(0, length) != expected))
+        {
+            AddViolation("wrong output for " + jobID + ": " + command);
+        }
+        CompletedJobs++;
+    }
+    else if (reply == "JOB " + jobID + " REMOVED\n")
+    {
+        RemovedJobs++;
+    }
+    else if (reply == "SERVER TERMINATED BEFORE EXECUTION")
+    {
+        TerminatedJobs++;
+    }
+    else
+    {
+        AddViolation("unexpected terminal response for " + jobID + ": " + reply);
+    }
+    RecordTerminal(jobID);
+    if (!AtEnd(socketFD))
+    {
+        AddViolation("more than one terminal response for " + jobID);
+    }
+}
+
+// poll, stop and setConcurrency each answer with a single message
+static void Request(const string& port, const string& command, const string& expectedPrefix)
+{
+    SocketManager connection;
+    int socketFD = Connect(connection, port);
+    string reply;
+    if (socketFD < 0 || !connection.SendMessage(socketFD, command) || !connection.ReceiveMessage(socketFD, reply))
+    {
+        AddViolation("no reply to " + command);
+        return;
+    }
+    if (reply.compare(0, expectedPrefix.size(), expectedPrefix) != 0)
+    {
+        AddViolation("unexpected reply to " + command + ": " + reply);
+    }
+    if (!AtEnd(socketFD))
+    {
+        AddViolation("more than one reply to " + command);
+    }
+}
+
+static void* ClientThread(void* arg)
+{
+    StressArgs* args = static_cast<StressArgs*>(arg);
+    mt19937 random(args->Seed);
+    int outputFD = memfd_create("jobStress", MFD_CLOEXEC);
+
+    for (int i = 0; i < args->Operations; i++)
+    {
+        unsigned choice = args->IssueOnly ? 0 : random() % 10;
+        if (choice < 6)
+        {
+            IssueJob(args->Port, random, outputFD);
+        }
+        else if (choice < 8)
+        {
+            pthread_mutex_lock(&ResultsMutex);
+            string jobID = RecentIDs.empty() ? "job_0" : RecentIDs[random() % RecentIDs.size()];
+            pthread_mutex_unlock(&ResultsMutex);
+            // Removed while queued, or not found once a worker has it
+            Request(args->Port, "stop " + jobID, "JOB " + jobID + " ");
+        }
+        else if (choice < 9)
+        {
+            Request(args->Port, "poll", "");
+        }
+        else
+        {
+            string level = to_string(random() % 4 + 1);
+            Request(args->Port, "setConcurrency " + level, "CONCURRENCY SET AT " + level);
+        }
+        OperationCount++;
+    }
+
+    close(outputFD);
+    return nullptr;
+}
+
+static void RunClients(vector<StressArgs>& clientArgs)
+{
+    vector<pthread_t> threads(clientArgs.size());
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        pthread_create(&threads[i], nullptr, ClientThread, &clientArgs[i]);
+    }
+    for (auto& thread : threads)
+    {
+        pthread_join(thread, nullptr);
+    }
+}
+
+// Every job handed an ID must have been answered exactly once
+static void CheckTerminals()
+{
+    pthread_mutex_lock(&ResultsMutex);
+    for (const auto& job : Terminals)
+    {
+        if (job.second != 1)
+        {
+            pthread_mutex_unlock(&ResultsMutex);
+            AddViolation(job.first + " got " + to_string(job.second) + " terminal responses");
+            pthread_mutex_lock(&ResultsMutex);
+        }
+    }
+    pthread_mutex_unlock(&ResultsMutex);
+}
+
+static int CountOpenFDs(pid_t pid)
+{
+    DIR* directory = opendir(("/proc/" + to_string(pid) + "/fd").c_str());
+    if (directory == nullptr)
+    {
+        return -1;
+    }
+    int count = 0;
+    while (struct dirent* entry = readdir(directory))
+    {
+        count += entry->d_name[0] != '.';
+    }
+    closedir(directory);
+    return count;
+}
+
+static pid_t StartServer(const string& serverPath, vector<string> arguments)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        vector<char*> argv;
+        argv.push_back(const_cast<char*>(serverPath.c_str()));
+        for (auto& argument : arguments)
+        {
+            argv.push_back(&argument[0]);
+        }
+        argv.push_back(nullptr);
+        execv(serverPath.c_str(), argv.data());
+        perror("Failed to start the server");
+        _exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+// Waits up to timeoutMs, kills the server if it is still around. True if it exited with status 0.
+static bool WaitForServer(pid_t pid, int timeoutMs, string& outcome)
+{
+    int status = 0;
+    for (int waited = 0; waitpid(pid, &status, WNOHANG) == 0; waited += 50)
+    {
+        if (waited >= timeoutMs)
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            outcome = "hung after exit, killed";
+            return false;
+        }
+        this_thread::sleep_for(chrono::milliseconds(50));
+    }
+    if (WIFSIGNALED(status))
+    {
+        outcome = "killed by signal " + to_string(WTERMSIG(status));
+        return false;
+    }
+    outcome = "exit status " + to_string(WEXITSTATUS(status));
+    return WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 5)
+    {
+        cerr << "Usage: " << argv[0] << " <serverBinary> <portNum> <clients> <operationsPerClient> [serverOptions...]" << endl;
+        return EXIT_FAILURE;
+    }
+    string serverPath = argv[1];
+    string port = argv[2];
+    int clients = stoi(argv[3]);
+    int operations = stoi(argv[4]);
+    // A small buffer so submitters also block on a full queue
+    vector<string> serverArguments = { port, "8", "4" };
+    serverArguments.insert(serverArguments.end(), argv + 5, argv + argc);
+
+    pid_t serverPID = StartServer(serverPath, serverArguments);
+    // The connection chatter of SocketManager would drown the results
+    cout.setstate(ios::failbit);
+    cerr.setstate(ios::failbit);
+    bool up = false;
+    for (int attempt = 0; attempt < 100 && !up; attempt++)
+    {
+        this_thread::sleep_for(chrono::milliseconds(100));
+        SocketManager probe;
+        up = probe.ResolveAndConnect("localhost", port);
+    }
+    cout.clear();
+    cerr.clear();
+    if (!up)
+    {
+        cerr << "Server did not come up on port " << port << endl;
+        kill(serverPID, SIGKILL);
+        waitpid(serverPID, nullptr, 0);
+        return EXIT_FAILURE;
+    }
+
+    // Warm up lazily opened descriptors before taking the baseline
+    vector<StressArgs> warmUp = { StressArgs{ port, 4, true, 1 } };
+    cout.setstate(ios::failbit);
+    cerr.setstate(ios::failbit);
+    RunClients(warmUp);
+    this_thread::sleep_for(chrono::milliseconds(200));
+    int baselineFDs = CountOpenFDs(serverPID);
+
+    vector<StressArgs> clientArgs;
+    for (int i = 0; i < clients; i++)
+    {
+        clientArgs.push_back(StressArgs{ port, operations, false, static_cast<unsigned>(i + 2) });
+    }
+    auto start = chrono::steady_clock::now();
+    RunClients(clientArgs);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    int loadOperations = OperationCount;
+    CheckTerminals();
+    cout.clear();
+    cerr.clear();
+    if (RejectedJobs > 0)
+    {
+        AddViolation(to_string(RejectedJobs) + " jobs rejected before exit");
+    }
+
+    // Client threads close their sockets just after the last response, give them a moment
+    int idleFDs = CountOpenFDs(serverPID);
+    for (int waited = 0; idleFDs > baselineFDs && waited < 3000; waited += 100)
+    {
+        this_thread::sleep_for(chrono::milliseconds(100));
+        idleFDs = CountOpenFDs(serverPID);
+    }
+    if (idleFDs > baselineFDs)
+    {
+        AddViolation("server holds " + to_string(idleFDs) + " fds when idle, " + to_string(baselineFDs) + " before the load");
+    }
+
+    // Shutdown race: submissions keep arriving while exit goes through
+    for (auto& args : clientArgs)
+    {
+        args.Operations = max(operations / 4, 1);
+        args.IssueOnly = true;
+        args.Seed += clients;
+    }
+    cout.setstate(ios::failbit);
+    cerr.setstate(ios::failbit); // Refused connections are expected from here on
+    pthread_t exitThread;
+    pthread_create(&exitThread, nullptr, [](void* arg) -> void*
+    {
+        this_thread::sleep_for(chrono::milliseconds(100));
+        Request(*static_cast<string*>(arg), "exit", "SERVER TERMINATED");
+        return nullptr;
+    }, &port);
+    RunClients(clientArgs);
+    pthread_join(exitThread, nullptr);
+    cout.clear();
+    cerr.clear();
+    CheckTerminals();
+
+    string outcome;
+    if (!WaitForServer(serverPID, 15000, outcome))
+    {
+        AddViolation("server " + outcome);
+    }
+
+    cout << loadOperations << " operations from " << clients << " clients in " << seconds << " s, "
+         << loadOperations / seconds << " ops/s" << endl;
+    cout << "jobs: " << Terminals.size() << " submitted, " << CompletedJobs << " completed, " << RemovedJobs
+         << " removed, " << TerminatedJobs << " terminated at exit, " << RejectedJobs << " rejected at exit" << endl;
+    cout << "server fds: " << baselineFDs << " before the load, " << idleFDs << " after; " << outcome << endl;
+    for (const auto& violation : Violations)
+    {
+        cout << "VIOLATION: " << violation << endl;
+    }
+    cout << (Violations.empty() ? "PASS" : "FAIL") << endl;
+    return Violations.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
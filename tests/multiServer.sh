@@ -0,0 +1,97 @@
+#!/bin/sh
+# Starts three sharded servers on localhost and checks routing, stop by shard, peer forwarding and
+# failover through jobCommander. Usage: multiServer.sh <binDir> <firstPort>
+BIN=$1
+PORT_A=$2
+PORT_B=$((PORT_A + 1))
+PORT_C=$((PORT_A + 2))
+SERVERS="a=localhost:$PORT_A,b=localhost:$PORT_B,c=localhost:$PORT_C"
+COMMANDER="$BIN/jobCommander"
+FAILURES=0
+WORK=$(mktemp -d)
+
+check()
+{
+    if [ "$2" = 0 ]; then
+        echo "ok: $1"
+    else
+        echo "FAILED: $1"
+        FAILURES=$((FAILURES + 1))
+    fi
+}
+
+# The job ID from the SUBMITTED line of a jobCommander transcript
+job_id()
+{
+    sed -n 's/^JOB \([^,]*\),.*SUBMITTED$/\1/p' "$1" | head -n 1
+}
+
+cd "$WORK" || exit 1
+# a has room for a single queued job and overflows to b
+"$BIN/jobExecutorServer" "$PORT_A" 1 1 --shard a --peers "localhost:$PORT_B" > a.log 2>&1 &
+"$BIN/jobExecutorServer" "$PORT_B" 8 1 --shard b > b.log 2>&1 &
+"$BIN/jobExecutorServer" "$PORT_C" 8 1 --shard c > c.log 2>&1 &
+sleep 0.5
+
+# Routing: IDs carry the shard, the same command always lands on the same server, and ten
+# different commands do not all land on one
+shards=""
+for i in 0 1 2 3 4 5 6 7 8 9; do
+    "$COMMANDER" "$SERVERS" issueJob echo route $i > route.out 2>/dev/null
+    shards="$shards $(job_id route.out | cut -d. -f1)"
+done
+echo "$shards" | tr ' ' '\n' | grep -qx '[abc]'
+check "job IDs carry their shard name" $?
+[ "$(echo "$shards" | tr ' ' '\n' | grep -x '[abc]' | sort -u | wc -l)" -ge 2 ]
+check "different commands spread over several servers" $?
+"$COMMANDER" "$SERVERS" issueJob echo route 3 > again.out 2>/dev/null
+[ "$(job_id again.out | cut -d. -f1)" = "$(echo $shards | cut -d' ' -f4)" ]
+check "the same command goes to the same server" $?
+
+# stop finds the owning shard from the ID alone
+"$COMMANDER" "c=localhost:$PORT_C" issueJob sleep 2 > running.out 2>/dev/null &
+sleep 0.3
+"$COMMANDER" "c=localhost:$PORT_C" issueJob echo queued > queued.out 2>/dev/null &
+clients="$!"
+sleep 0.3
+queued=$(job_id queued.out)
+"$COMMANDER" "$SERVERS" stop "$queued" > stop.out 2>/dev/null
+grep -q "JOB $queued REMOVED" stop.out
+check "stop $queued reaches its shard" $?
+# Without names in the list, stop asks every server
+"$COMMANDER" "localhost:$PORT_A,localhost:$PORT_C" stop c.job_99 > broadcast.out 2>/dev/null
+grep -q "JOB c.job_99 NOT FOUND" broadcast.out && ! grep -q '^$' broadcast.out
+check "stop without a matching name asks every server, without a blank line" $?
+wait $clients
+
+# Forwarding: with a busy and its one queue slot taken, the next job runs on b
+"$COMMANDER" "a=localhost:$PORT_A" issueJob sleep 2 > busy1.out 2>/dev/null &
+sleep 0.3
+"$COMMANDER" "a=localhost:$PORT_A" issueJob sleep 1 > busy2.out 2>/dev/null &
+clients="$!"
+sleep 0.3
+"$COMMANDER" "a=localhost:$PORT_A" issueJob echo overflow > forwarded.out 2>/dev/null
+case "$(job_id forwarded.out)" in b.*) forwarded=0 ;; *) forwarded=1 ;; esac
+check "a full server forwards to its peer" $forwarded
+grep -qx overflow forwarded.out
+check "the forwarded job's output is relayed back" $?
+wait $clients
+
+# Failover: with c down, every job still runs on a or b
+"$COMMANDER" "c=localhost:$PORT_C" exit > /dev/null 2>&1
+sleep 0.3
+failover=0
+for i in 0 1 2 3 4 5 6 7 8 9; do
+    "$COMMANDER" "$SERVERS" issueJob echo failover $i > failover.out 2>/dev/null
+    grep -qx "failover $i" failover.out || failover=1
+done
+check "jobs fail over from a stopped server" $failover
+
+"$COMMANDER" "a=localhost:$PORT_A,b=localhost:$PORT_B" exit > /dev/null 2>&1
+wait
+cd / && rm -rf "$WORK"
+if [ "$FAILURES" -ne 0 ]; then
+    echo "$FAILURES checks failed"
+    exit 1
+fi
+echo PASS